@@ -0,0 +1,961 @@
+/* actor.c - Isolated interpreters on threads of their own, passing messages */
+/* By Tore Banta & Charlie Sarano                                            */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "hashtable.h"
+#include "pmap.h"
+#include "future.h"
+#include "record.h"
+#include "bytevector.h"
+#include "actor.h"
+
+// Messages each mailbox holds. A sender finding it full waits for room.
+#define MAILBOX_SIZE 1024
+
+// Stack given to each actor's thread
+#define ACTOR_STACK_SIZE (8 * 1024 * 1024)
+
+// Times a receiver finding its mailbox empty, or a sender finding it full,
+// looks again, yielding in between, before sleeping
+#define IDLE_SPINS 64
+
+// A mailbox is a bounded queue any thread may put messages in, as given by
+// Vyukov. Each slot's sequence number says whose turn it is: a slot is free
+// for the put at position p when its sequence is p, and holds the message
+// for the take at position p when its sequence is p + 1.
+typedef struct MailboxSlot {
+    unsigned long sequence;
+    unsigned char *message;
+} MailboxSlot;
+
+struct Actor {
+    unsigned long head;
+    char headPad[56]; // keeps head and tail on separate cache lines
+    unsigned long tail;
+    char tailPad[56];
+    MailboxSlot slots[MAILBOX_SIZE];
+    // The owner sets sleeping before waiting on wakeUp for a message, and
+    // senders count themselves in blockedSenders before waiting on roomFree
+    // for a slot
+    int sleeping;
+    int blockedSenders;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeUp;
+    pthread_cond_t roomFree;
+    // Set when the actor's procedure has returned
+    int done;
+    // The packed procedure and arguments, until the actor's thread starts
+    unsigned char *start;
+    // Where the spawner's output went, which the actor's goes to too
+    FILE *output;
+};
+
+// Actors whose procedures haven't returned yet
+int runningActors = 0;
+
+__thread struct Actor *currentActor = NULL;
+
+// Makes an actor with an empty mailbox. Other threads may hold on to it for
+// as long as the program runs, so it isn't talloc'd and is never freed.
+struct Actor *makeActor() {
+    struct Actor *actor = calloc(1, sizeof(struct Actor));
+    if (actor == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        texit(1);
+    }
+    for (unsigned long i = 0; i < MAILBOX_SIZE; i++) {
+        actor->slots[i].sequence = i;
+    }
+    pthread_mutex_init(&actor->lock, NULL);
+    pthread_cond_init(&actor->wakeUp, NULL);
+    pthread_cond_init(&actor->roomFree, NULL);
+    return actor;
+}
+
+// Adds a message to an actor's mailbox, returning 0 if it is full
+int mailboxPut(struct Actor *actor, unsigned char *message) {
+    unsigned long position = __atomic_load_n(&actor->tail, __ATOMIC_RELAXED);
+    MailboxSlot *slot;
+    while (1) {
+        slot = &actor->slots[position % MAILBOX_SIZE];
+        unsigned long sequence = __atomic_load_n(&slot->sequence,
+                                                 __ATOMIC_ACQUIRE);
+        long difference = (long) (sequence - position);
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&actor->tail, &position,
+                                            position + 1, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if (difference < 0) {
+            return 0;
+        }
+        else {
+            // Another sender got this slot first
+            position = __atomic_load_n(&actor->tail, __ATOMIC_RELAXED);
+        }
+    }
+    slot->message = message;
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Removes the oldest message from an actor's mailbox, or returns NULL if it
+// is empty
+unsigned char *mailboxTake(struct Actor *actor) {
+    unsigned long position = __atomic_load_n(&actor->head, __ATOMIC_RELAXED);
+    MailboxSlot *slot;
+    while (1) {
+        slot = &actor->slots[position % MAILBOX_SIZE];
+        unsigned long sequence = __atomic_load_n(&slot->sequence,
+                                                 __ATOMIC_ACQUIRE);
+        long difference = (long) (sequence - (position + 1));
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&actor->head, &position,
+                                            position + 1, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if (difference < 0) {
+            return NULL;
+        }
+        else {
+            position = __atomic_load_n(&actor->head, __ATOMIC_RELAXED);
+        }
+    }
+    unsigned char *message = slot->message;
+    __atomic_store_n(&slot->sequence, position + MAILBOX_SIZE,
+                     __ATOMIC_RELEASE);
+    return message;
+}
+
+// A value is copied by packing it into a buffer on the sending thread and
+// unpacking the buffer into the receiving thread's heap. Each Value, frame
+// and lambda description is packed once, numbered in the order they are
+// first reached, and referred to by number after that, so shared and cyclic
+// structure, like closures in a global frame that captured that frame, is
+// copied as it is.
+enum {PACK_NOTHING, PACK_REF, PACK_INT, PACK_DOUBLE, PACK_BOOL, PACK_NULL,
+      PACK_VOID, PACK_STR, PACK_SYMBOL, PACK_CONS, PACK_CLOSURE,
+      PACK_PRIMITIVE, PACK_MEMOIZED, PACK_HASH, PACK_PMAP, PACK_ACTOR,
+      PACK_FRAME, PACK_LAMBDA, PACK_RECORD, PACK_RECORD_PROC,
+      PACK_BYTEVECTOR, PACK_MAPPED};
+
+typedef struct Packer {
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+    // The addresses of the objects packed so far, hashed, and their numbers
+    void **seen;
+    unsigned long *numbers;
+    unsigned long seenCapacity;
+    unsigned long seenCount;
+    // Set when something that can't be copied is reached
+    int failed;
+    // The Shared blocks the message refers to, each held once by it
+    Shared **held;
+    int heldCount;
+    int heldCapacity;
+} Packer;
+
+// Allocates with malloc, exiting if there is no memory
+void *packAlloc(void *old, size_t size) {
+    void *block = realloc(old, size);
+    if (block == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        texit(1);
+    }
+    return block;
+}
+
+void packBytes(Packer *packer, const void *bytes, size_t count) {
+    if (packer->length + count > packer->capacity) {
+        while (packer->length + count > packer->capacity) {
+            packer->capacity *= 2;
+        }
+        packer->data = packAlloc(packer->data, packer->capacity);
+    }
+    memcpy(packer->data + packer->length, bytes, count);
+    packer->length += count;
+}
+
+void packByte(Packer *packer, unsigned char byte) {
+    packBytes(packer, &byte, 1);
+}
+
+void packWord(Packer *packer, unsigned long word) {
+    packBytes(packer, &word, sizeof(word));
+}
+
+void packPointer(Packer *packer, void *pointer) {
+    packBytes(packer, &pointer, sizeof(pointer));
+}
+
+void packString(Packer *packer, char *string) {
+    size_t length = strlen(string);
+    packWord(packer, length);
+    packBytes(packer, string, length);
+}
+
+// Packs a pointer to a Shared block, which the message holds a reference to
+// until it is unpacked or discarded
+void packShared(Packer *packer, Shared *shared) {
+    packPointer(packer, shared);
+    for (int i = 0; i < packer->heldCount; i++) {
+        if (packer->held[i] == shared) {
+            return;
+        }
+    }
+    if (packer->heldCount == packer->heldCapacity) {
+        packer->heldCapacity *= 2;
+        packer->held = packAlloc(packer->held, packer->heldCapacity *
+                                               sizeof(Shared *));
+    }
+    sharedHold(shared);
+    packer->held[packer->heldCount++] = shared;
+}
+
+// Slot of object in the seen table: where it is, or the empty slot it would go
+unsigned long seenSlot(Packer *packer, void *object) {
+    unsigned long slot = ((unsigned long) object >> 4) * 2654435761UL;
+    slot &= packer->seenCapacity - 1;
+    while (packer->seen[slot] != NULL && packer->seen[slot] != object) {
+        slot = (slot + 1) & (packer->seenCapacity - 1);
+    }
+    return slot;
+}
+
+// Packs a reference to object if it has been packed before and returns 1,
+// otherwise gives it the next number and returns 0
+int packReference(Packer *packer, void *object) {
+    unsigned long slot = seenSlot(packer, object);
+    if (packer->seen[slot] != NULL) {
+        packByte(packer, PACK_REF);
+        packWord(packer, packer->numbers[slot]);
+        return 1;
+    }
+    packer->seen[slot] = object;
+    packer->numbers[slot] = packer->seenCount++;
+    if (packer->seenCount * 2 > packer->seenCapacity) {
+        // Rehash into a table twice the size
+        void **old_seen = packer->seen;
+        unsigned long *old_numbers = packer->numbers;
+        unsigned long old_capacity = packer->seenCapacity;
+        packer->seenCapacity *= 2;
+        packer->seen = calloc(packer->seenCapacity, sizeof(void *));
+        packer->numbers = packAlloc(NULL, packer->seenCapacity *
+                                          sizeof(unsigned long));
+        if (packer->seen == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            texit(1);
+        }
+        for (unsigned long i = 0; i < old_capacity; i++) {
+            if (old_seen[i] != NULL) {
+                unsigned long new_slot = seenSlot(packer, old_seen[i]);
+                packer->seen[new_slot] = old_seen[i];
+                packer->numbers[new_slot] = old_numbers[i];
+            }
+        }
+        free(old_seen);
+        free(old_numbers);
+    }
+    return 0;
+}
+
+void packValue(Packer *packer, Value *value);
+
+void packLambda(Packer *packer, struct Lambda *lambda) {
+    // Only the code is packed; the receiver works the rest out again
+    if (packReference(packer, lambda)) {
+        return;
+    }
+    packByte(packer, PACK_LAMBDA);
+    packValue(packer, lambda->paramNames);
+    packValue(packer, lambda->functionCode);
+}
+
+void packFrame(Packer *packer, Frame *frame) {
+    if (frame == NULL) {
+        packByte(packer, PACK_NOTHING);
+        return;
+    }
+    if (packReference(packer, frame)) {
+        return;
+    }
+    packByte(packer, PACK_FRAME);
+    packValue(packer, frame->bindings);
+    packFrame(packer, frame->parent);
+}
+
+// Packs one key and value of a persistent map
+void packPair(Value *key, Value *value, void *data) {
+    packValue(data, key);
+    packValue(data, value);
+}
+
+void packValue(Packer *packer, Value *value) {
+    // Lists are followed along their cdrs in a loop, so that long ones don't
+    // need a deep C stack
+    while (1) {
+        if (value == NULL) {
+            // A binding letrec hasn't given a value yet
+            packByte(packer, PACK_NOTHING);
+            return;
+        }
+        switch (value->type) {
+            case INT_TYPE:
+                packByte(packer, PACK_INT);
+                packWord(packer, (unsigned long) value->i);
+                return;
+            case DOUBLE_TYPE:
+                packByte(packer, PACK_DOUBLE);
+                packBytes(packer, &value->d, sizeof(double));
+                return;
+            case BOOL_TYPE:
+                packByte(packer, PACK_BOOL);
+                packByte(packer, value->i != 0);
+                return;
+            case NULL_TYPE:
+                packByte(packer, PACK_NULL);
+                return;
+            case VOID_TYPE:
+                packByte(packer, PACK_VOID);
+                return;
+            case PRIMITIVE_TYPE:
+                packByte(packer, PACK_PRIMITIVE);
+                packPointer(packer, value->prim);
+                return;
+            case ACTOR_TYPE:
+                packByte(packer, PACK_ACTOR);
+                packPointer(packer, value->actor);
+                return;
+            case STR_TYPE:
+            case SYMBOL_TYPE:
+            case CONS_TYPE:
+            case CLOSURE_TYPE:
+            case MEMOIZED_TYPE:
+            case HASH_TYPE:
+            case PMAP_TYPE:
+            case RECORD_TYPE:
+            case RECORD_PROC_TYPE:
+            case BYTEVECTOR_TYPE:
+                break;
+            default:
+                // Futures, whose results belong to the thread that made them
+                packer->failed = 1;
+                packByte(packer, PACK_NOTHING);
+                return;
+        }
+        if (packReference(packer, value)) {
+            return;
+        }
+        switch (value->type) {
+            case STR_TYPE:
+                packByte(packer, PACK_STR);
+                packWord(packer, value->str.length);
+                packBytes(packer, value->str.chars, value->str.length);
+                return;
+            case SYMBOL_TYPE:
+                packByte(packer, PACK_SYMBOL);
+                packString(packer, value->s);
+                return;
+            case CONS_TYPE:
+                packByte(packer, PACK_CONS);
+                packValue(packer, value->c.car);
+                value = value->c.cdr;
+                continue;
+            case CLOSURE_TYPE:
+                packByte(packer, PACK_CLOSURE);
+                packLambda(packer, value->cl.lambda);
+                packFrame(packer, value->cl.frame);
+                return;
+            case MEMOIZED_TYPE:
+                // The copy starts with an empty table
+                packByte(packer, PACK_MEMOIZED);
+                packValue(packer, value->memo->function);
+                return;
+            case HASH_TYPE: {
+                packByte(packer, PACK_HASH);
+                packByte(packer, value->table->mode);
+                packWord(packer, value->table->count);
+                unsigned long position = 0;
+                HashEntry *entry;
+                hashLock(value->table);
+                while ((entry = hashNext(value->table, &position)) != NULL) {
+                    packValue(packer, entry->key);
+                    packValue(packer, entry->value);
+                }
+                hashUnlock(value->table);
+                return;
+            }
+            case PMAP_TYPE:
+                packByte(packer, PACK_PMAP);
+                packWord(packer, value->pmap->count);
+                pmapEach(value->pmap, packPair, packer);
+                return;
+            case RECORD_TYPE:
+                packByte(packer, PACK_RECORD);
+                packShared(packer, &value->record->type->shared);
+                for (int i = 0; i < value->record->type->fieldCount; i++) {
+                    packValue(packer, value->record->slots[i]);
+                }
+                return;
+            case BYTEVECTOR_TYPE: {
+                struct Bytevector *bytevector = value->bytevector;
+                if (bytevector->readOnly) {
+                    // A mapped file, which is never changed
+                    packByte(packer, PACK_MAPPED);
+                    packShared(packer, &bytevector->mapping->shared);
+                    return;
+                }
+                packByte(packer, PACK_BYTEVECTOR);
+                packWord(packer, bytevector->length);
+                packBytes(packer, bytevector->data, bytevector->length);
+                return;
+            }
+            case RECORD_PROC_TYPE: {
+                struct RecordProcedure *procedure = value->recordProc;
+                packByte(packer, PACK_RECORD_PROC);
+                packByte(packer, procedure->kind);
+                packWord(packer, procedure->slot);
+                packWord(packer, procedure->argc);
+                if (procedure->kind == RECORD_CONSTRUCTOR) {
+                    packBytes(packer, procedure->argSlots,
+                              procedure->argc * sizeof(int));
+                }
+                packShared(packer, &procedure->type->shared);
+                return;
+            }
+        }
+    }
+}
+
+// Returns a copy of value packed into a buffer from malloc, or NULL if it
+// holds something that can't be copied. The buffer starts with the offset of
+// a list of the Shared blocks the message holds, which follows the value.
+unsigned char *pack(Value *value) {
+    Packer packer;
+    packer.capacity = 256;
+    packer.length = sizeof(unsigned long);
+    packer.data = packAlloc(NULL, packer.capacity);
+    packer.seenCapacity = 64;
+    packer.seenCount = 0;
+    packer.seen = calloc(packer.seenCapacity, sizeof(void *));
+    packer.numbers = packAlloc(NULL, packer.seenCapacity *
+                                     sizeof(unsigned long));
+    packer.failed = 0;
+    packer.heldCapacity = 4;
+    packer.heldCount = 0;
+    packer.held = packAlloc(NULL, packer.heldCapacity * sizeof(Shared *));
+    if (packer.seen == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        texit(1);
+    }
+    packValue(&packer, value);
+    free(packer.seen);
+    free(packer.numbers);
+    if (packer.failed) {
+        for (int i = 0; i < packer.heldCount; i++) {
+            sharedDrop(packer.held[i]);
+        }
+        free(packer.held);
+        free(packer.data);
+        return NULL;
+    }
+    unsigned long held_offset = packer.length;
+    memcpy(packer.data, &held_offset, sizeof(held_offset));
+    packWord(&packer, packer.heldCount);
+    for (int i = 0; i < packer.heldCount; i++) {
+        packPointer(&packer, packer.held[i]);
+    }
+    free(packer.held);
+    return packer.data;
+}
+
+// Frees a message nobody will unpack, dropping its references
+void discardMessage(unsigned char *data) {
+    unsigned long held_offset;
+    memcpy(&held_offset, data, sizeof(held_offset));
+    unsigned long count;
+    memcpy(&count, data + held_offset, sizeof(count));
+    for (unsigned long i = 0; i < count; i++) {
+        Shared *shared;
+        memcpy(&shared, data + held_offset + sizeof(count) +
+                        i * sizeof(shared), sizeof(shared));
+        sharedDrop(shared);
+    }
+    free(data);
+}
+
+typedef struct Unpacker {
+    unsigned char *data;
+    size_t position;
+    // Everything unpacked that may be referred to again, by number
+    void **objects;
+    unsigned long count;
+    unsigned long capacity;
+    // Every closure unpacked, whose lambdas need describing
+    Value *closures;
+} Unpacker;
+
+void unpackBytes(Unpacker *unpacker, void *bytes, size_t count) {
+    memcpy(bytes, unpacker->data + unpacker->position, count);
+    unpacker->position += count;
+}
+
+unsigned char unpackByte(Unpacker *unpacker) {
+    return unpacker->data[unpacker->position++];
+}
+
+unsigned long unpackWord(Unpacker *unpacker) {
+    unsigned long word;
+    unpackBytes(unpacker, &word, sizeof(word));
+    return word;
+}
+
+void *unpackPointer(Unpacker *unpacker) {
+    void *pointer;
+    unpackBytes(unpacker, &pointer, sizeof(pointer));
+    return pointer;
+}
+
+char *unpackString(Unpacker *unpacker) {
+    size_t length = unpackWord(unpacker);
+    char *string = talloc(length + 1);
+    unpackBytes(unpacker, string, length);
+    string[length] = '\0';
+    return string;
+}
+
+// Gives object the next number
+void unpackRecord(Unpacker *unpacker, void *object) {
+    if (unpacker->count == unpacker->capacity) {
+        unpacker->capacity *= 2;
+        unpacker->objects = packAlloc(unpacker->objects, unpacker->capacity *
+                                                         sizeof(void *));
+    }
+    unpacker->objects[unpacker->count++] = object;
+}
+
+Value *newValue(valueType type) {
+    Value *value = talloc(sizeof(Value));
+    value->type = type;
+    return value;
+}
+
+Value *unpackValue(Unpacker *unpacker);
+
+struct Lambda *unpackLambda(Unpacker *unpacker) {
+    if (unpackByte(unpacker) == PACK_REF) {
+        return unpacker->objects[unpackWord(unpacker)];
+    }
+    struct Lambda *lambda = talloc(sizeof(struct Lambda));
+    unpackRecord(unpacker, lambda);
+    lambda->paramNames = unpackValue(unpacker);
+    lambda->functionCode = unpackValue(unpacker);
+    lambda->localFrame = 0;
+    lambda->flat = 0;
+    lambda->freeNames = makeNull();
+    return lambda;
+}
+
+Frame *unpackFrame(Unpacker *unpacker) {
+    int tag = unpackByte(unpacker);
+    if (tag == PACK_NOTHING) {
+        return NULL;
+    }
+    if (tag == PACK_REF) {
+        return unpacker->objects[unpackWord(unpacker)];
+    }
+    Frame *frame = talloc(sizeof(Frame));
+    unpackRecord(unpacker, frame);
+    frame->bindings = unpackValue(unpacker);
+    frame->parent = unpackFrame(unpacker);
+    return frame;
+}
+
+// Unpacks anything but a cons cell, given its tag
+Value *unpackOne(Unpacker *unpacker, int tag) {
+    Value *value;
+    switch (tag) {
+        case PACK_REF:
+            return unpacker->objects[unpackWord(unpacker)];
+        case PACK_INT:
+            value = newValue(INT_TYPE);
+            value->i = (int) unpackWord(unpacker);
+            return value;
+        case PACK_DOUBLE:
+            value = newValue(DOUBLE_TYPE);
+            unpackBytes(unpacker, &value->d, sizeof(double));
+            return value;
+        case PACK_BOOL:
+            value = newValue(BOOL_TYPE);
+            value->i = unpackByte(unpacker);
+            return value;
+        case PACK_NULL:
+            return makeNull();
+        case PACK_VOID:
+            return newValue(VOID_TYPE);
+        case PACK_PRIMITIVE:
+            value = newValue(PRIMITIVE_TYPE);
+            value->prim = unpackPointer(unpacker);
+            return value;
+        case PACK_ACTOR:
+            value = newValue(ACTOR_TYPE);
+            value->actor = unpackPointer(unpacker);
+            return value;
+        case PACK_STR:
+            // A substring comes with just its own characters
+            value = newValue(STR_TYPE);
+            unpackRecord(unpacker, value);
+            value->str.chars = unpackString(unpacker);
+            value->str.length = strlen(value->str.chars);
+            return value;
+        case PACK_SYMBOL:
+            // Not yet looked at by resolveGlobals()
+            value = newValue(SYMBOL_TYPE);
+            unpackRecord(unpacker, value);
+            value->sym.name = unpackString(unpacker);
+            value->sym.cell = NULL;
+            value->sym.version = SYMBOL_UNCACHED;
+            return value;
+        case PACK_CLOSURE:
+            value = newValue(CLOSURE_TYPE);
+            unpackRecord(unpacker, value);
+            value->cl.lambda = unpackLambda(unpacker);
+            value->cl.frame = unpackFrame(unpacker);
+            unpacker->closures = cons(value, unpacker->closures);
+            return value;
+        case PACK_MEMOIZED:
+            value = newValue(MEMOIZED_TYPE);
+            unpackRecord(unpacker, value);
+            value->memo = talloc(sizeof(struct Memo));
+            value->memo->table = makeHashTable(HASH_EQUAL);
+            value->memo->hits = 0;
+            value->memo->misses = 0;
+            value->memo->function = unpackValue(unpacker);
+            return value;
+        case PACK_HASH: {
+            value = newValue(HASH_TYPE);
+            unpackRecord(unpacker, value);
+            value->table = makeHashTable(unpackByte(unpacker));
+            unsigned long count = unpackWord(unpacker);
+            for (unsigned long i = 0; i < count; i++) {
+                Value *key = unpackValue(unpacker);
+                hashPut(value->table, key, unpackValue(unpacker));
+            }
+            return value;
+        }
+        case PACK_PMAP: {
+            value = newValue(PMAP_TYPE);
+            unpackRecord(unpacker, value);
+            Pmap *map = pmapEmpty();
+            unsigned long count = unpackWord(unpacker);
+            for (unsigned long i = 0; i < count; i++) {
+                Value *key = unpackValue(unpacker);
+                map = pmapAssoc(map, key, unpackValue(unpacker));
+            }
+            value->pmap = map;
+            return value;
+        }
+        case PACK_RECORD: {
+            struct RecordType *type = unpackPointer(unpacker);
+            value = makeRecord(type);
+            unpackRecord(unpacker, value);
+            for (int i = 0; i < type->fieldCount; i++) {
+                value->record->slots[i] = unpackValue(unpacker);
+            }
+            return value;
+        }
+        case PACK_BYTEVECTOR: {
+            size_t length = unpackWord(unpacker);
+            value = makeBytevector(length);
+            unpackRecord(unpacker, value);
+            unpackBytes(unpacker, value->bytevector->data, length);
+            return value;
+        }
+        case PACK_MAPPED: {
+            value = mappedBytevector(unpackPointer(unpacker));
+            unpackRecord(unpacker, value);
+            return value;
+        }
+        case PACK_RECORD_PROC: {
+            value = newValue(RECORD_PROC_TYPE);
+            unpackRecord(unpacker, value);
+            struct RecordProcedure *procedure =
+                talloc(sizeof(struct RecordProcedure));
+            procedure->kind = unpackByte(unpacker);
+            procedure->slot = (int) unpackWord(unpacker);
+            procedure->argc = (int) unpackWord(unpacker);
+            procedure->argSlots = NULL;
+            if (procedure->kind == RECORD_CONSTRUCTOR) {
+                procedure->argSlots = talloc(procedure->argc * sizeof(int));
+                unpackBytes(unpacker, procedure->argSlots,
+                            procedure->argc * sizeof(int));
+            }
+            procedure->type = unpackPointer(unpacker);
+            value->recordProc = procedure;
+            return value;
+        }
+    }
+    return NULL;
+}
+
+Value *unpackValue(Unpacker *unpacker) {
+    // Each cell of a list is numbered before its car is unpacked, as it was
+    // packed, and the list followed along its cdrs in a loop
+    Value *first = NULL;
+    Value **rest = &first;
+    while (1) {
+        int tag = unpackByte(unpacker);
+        if (tag != PACK_CONS) {
+            *rest = unpackOne(unpacker, tag);
+            return first;
+        }
+        Value *cell = cons(NULL, NULL);
+        unpackRecord(unpacker, cell);
+        *rest = cell;
+        cell->c.car = unpackValue(unpacker);
+        rest = &cell->c.cdr;
+    }
+}
+
+// Adds the names of the variables bound in the frames of a closure below the
+// global one to bound, if they aren't there already
+Value *addFrameNames(Value *closure, Value *bound) {
+    for (Frame *frame = closure->cl.frame;
+         frame != NULL && frame->parent != NULL; frame = frame->parent) {
+        Value *bindings = frame->bindings;
+        while (bindings != NULL && bindings->type == CONS_TYPE) {
+            Value *name = car(car(bindings));
+            int known = 0;
+            for (Value *cell = bound; cell->type == CONS_TYPE && !known;
+                 cell = cdr(cell)) {
+                known = strcmp(car(cell)->s, name->s) == 0;
+            }
+            if (!known) {
+                bound = cons(name, bound);
+            }
+            bindings = cdr(bindings);
+        }
+    }
+    return bound;
+}
+
+// Describes the lambda of every closure unpacked, counting a variable as bound
+// in it if any of its closures' frames binds it
+void describeClosures(Unpacker *unpacker) {
+    struct Lambda **lambdas = NULL;
+    Value **bounds = NULL;
+    int count = 0;
+    for (Value *cell = unpacker->closures; cell->type == CONS_TYPE;
+         cell = cdr(cell)) {
+        Value *closure = car(cell);
+        int i = 0;
+        while (i < count && lambdas[i] != closure->cl.lambda) {
+            i++;
+        }
+        if (i == count) {
+            lambdas = packAlloc(lambdas, (count + 1) * sizeof(struct Lambda *));
+            bounds = packAlloc(bounds, (count + 1) * sizeof(Value *));
+            lambdas[count] = closure->cl.lambda;
+            bounds[count] = makeNull();
+            count++;
+        }
+        bounds[i] = addFrameNames(closure, bounds[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        redescribeLambda(lambdas[i], bounds[i]);
+    }
+    free(lambdas);
+    free(bounds);
+}
+
+// Unpacks a buffer made by pack into the calling thread's heap, and frees it
+Value *unpack(unsigned char *data) {
+    Unpacker unpacker;
+    unpacker.data = data;
+    unpacker.position = sizeof(unsigned long);
+    unpacker.capacity = 64;
+    unpacker.count = 0;
+    unpacker.objects = packAlloc(NULL, unpacker.capacity * sizeof(void *));
+    unpacker.closures = makeNull();
+    Value *value = unpackValue(&unpacker);
+    // The message's references are handed to the heap
+    unsigned long count = unpackWord(&unpacker);
+    for (unsigned long i = 0; i < count; i++) {
+        Shared *shared = unpackPointer(&unpacker);
+        tshare(shared);
+        sharedDrop(shared);
+    }
+    free(unpacker.objects);
+    free(data);
+    describeClosures(&unpacker);
+    return value;
+}
+
+// Body of each actor's thread: call the procedure, then clear up
+void *actorMain(void *data) {
+    // Profiling samples go to the main thread, whose stack they describe
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    struct Actor *actor = data;
+    currentActor = actor;
+    outputFile = actor->output;
+    tallocThreadStart();
+    initStackLimit(ACTOR_STACK_SIZE);
+
+    jmp_buf trap;
+    exitTrap = &trap;
+    if (setjmp(trap) == 0) {
+        Value *call = unpack(actor->start);
+        actor->start = NULL;
+        int argc = length(cdr(call));
+        Value **argv = talloc((argc + 1) * sizeof(Value *));
+        int i = 0;
+        for (Value *arg = cdr(call); arg->type == CONS_TYPE; arg = cdr(arg)) {
+            argv[i++] = car(arg);
+        }
+        apply(car(call), argc, argv);
+    }
+    else {
+        // Reached through texit; the error has been reported, and ends just
+        // this actor
+        resetEvaluator();
+    }
+    exitTrap = NULL;
+
+    // Futures the actor made may still be using its heap
+    futureWaitAll();
+    pthread_mutex_lock(&actor->lock);
+    __atomic_store_n(&actor->done, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&actor->roomFree);
+    pthread_mutex_unlock(&actor->lock);
+    unsigned char *message;
+    while ((message = mailboxTake(actor)) != NULL) {
+        discardMessage(message);
+    }
+    tallocThreadEnd();
+    __atomic_fetch_sub(&runningActors, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+struct Actor *spawnActor(Value *procedure, Value *args) {
+    unsigned char *start = pack(cons(procedure, args));
+    if (start == NULL) {
+        return NULL;
+    }
+    struct Actor *actor = makeActor();
+    actor->start = start;
+    actor->output = outputFile;
+    __atomic_fetch_add(&runningActors, 1, __ATOMIC_SEQ_CST);
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, ACTOR_STACK_SIZE);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    if (pthread_create(&thread, &attributes, actorMain, actor) != 0) {
+        fprintf(stderr, "Can't start actor thread\n");
+        texit(1);
+    }
+    pthread_attr_destroy(&attributes);
+    return actor;
+}
+
+int sendMessage(struct Actor *actor, Value *message) {
+    unsigned char *packed = pack(message);
+    if (packed == NULL) {
+        return 0;
+    }
+    int put = mailboxPut(actor, packed);
+    for (int spins = 0; !put && spins < IDLE_SPINS; spins++) {
+        sched_yield();
+        put = mailboxPut(actor, packed);
+    }
+    if (!put) {
+        pthread_mutex_lock(&actor->lock);
+        __atomic_fetch_add(&actor->blockedSenders, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (!(put = mailboxPut(actor, packed)) &&
+               !__atomic_load_n(&actor->done, __ATOMIC_SEQ_CST)) {
+            pthread_cond_wait(&actor->roomFree, &actor->lock);
+        }
+        __atomic_fetch_sub(&actor->blockedSenders, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&actor->lock);
+    }
+    if (__atomic_load_n(&actor->done, __ATOMIC_SEQ_CST)) {
+        // Nobody will take it. A message put just after the actor emptied
+        // its mailbox is lost, rather than locking every send.
+        if (!put) {
+            discardMessage(packed);
+        }
+        unsigned char *unread;
+        while ((unread = mailboxTake(actor)) != NULL) {
+            discardMessage(unread);
+        }
+        return 1;
+    }
+    // Either the receiver finds the message before it sleeps, or this finds
+    // it sleeping
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&actor->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&actor->lock);
+        pthread_cond_signal(&actor->wakeUp);
+        pthread_mutex_unlock(&actor->lock);
+    }
+    return 1;
+}
+
+Value *receiveMessage() {
+    struct Actor *actor = selfActor();
+    unsigned char *message = mailboxTake(actor);
+    for (int spins = 0; message == NULL && spins < IDLE_SPINS; spins++) {
+        sched_yield();
+        message = mailboxTake(actor);
+    }
+    if (message == NULL) {
+        pthread_mutex_lock(&actor->lock);
+        __atomic_store_n(&actor->sleeping, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while ((message = mailboxTake(actor)) == NULL) {
+            pthread_cond_wait(&actor->wakeUp, &actor->lock);
+        }
+        __atomic_store_n(&actor->sleeping, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&actor->lock);
+    }
+    // As in sendMessage, with the roles swapped
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&actor->blockedSenders, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&actor->lock);
+        pthread_cond_signal(&actor->roomFree);
+        pthread_mutex_unlock(&actor->lock);
+    }
+    return unpack(message);
+}
+
+struct Actor *selfActor() {
+    if (currentActor == NULL) {
+        currentActor = makeActor();
+    }
+    return currentActor;
+}
+
+int actorsRunning() {
+    return __atomic_load_n(&runningActors, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,41 @@
+#include "value.h"
+
+#ifndef _ACTOR
+#define _ACTOR
+
+// Actors: (spawn proc arg ...) starts a thread with an interpreter of its own,
+// which calls proc on the args, and returns the new actor. Actors share
+// nothing: proc, the args and every message are deep copied into the heap of
+// the thread that receives them, closures along with the frames they have
+// captured, down to a copy of the sender's global frame. (send actor msg)
+// puts a copy of msg in the actor's mailbox, and (receive) takes the oldest
+// message from the calling thread's own, waiting for one if it is empty.
+// (self) returns the calling thread's actor, which any thread has, so that
+// it can be sent to others to reply to.
+//
+// Futures can't be copied, and sending one is an error. Actors, primitives
+// and record types are the same in every interpreter and are passed as they
+// are, so a copied record is still of the type its accessors check for.
+// An error in an actor ends that actor only, and messages sent to an actor
+// that has finished are dropped. The program ends when the main program does,
+// whether or not its actors have finished.
+
+// Starts an actor calling procedure on the list args, or returns NULL if they
+// hold something that can't be copied
+struct Actor *spawnActor(Value *procedure, Value *args);
+
+// Puts a copy of message in actor's mailbox, waiting while the mailbox is
+// full, and returns 1, or returns 0 if message can't be copied
+int sendMessage(struct Actor *actor, Value *message);
+
+// Takes the oldest message from the calling thread's mailbox, waiting for one
+// if it is empty
+Value *receiveMessage();
+
+// Returns the calling thread's actor, making it a mailbox if it has none
+struct Actor *selfActor();
+
+// Returns the number of actors that are still running
+int actorsRunning();
+
+#endif
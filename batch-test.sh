@@ -0,0 +1,35 @@
+#!/bin/bash
+# batch-test.sh - Runs every interpreter test program together with --batch,
+# on one thread and on several, and checks the output is the same as running
+# each on its own. Many of the programs end in an error, so this also checks
+# that an error leaves nothing behind for the next program run by the same
+# thread (tasks, stacks and the like), and one of them ends in an error
+# inside a future, which must not end the programs run with it.
+#
+# Usage: ./batch-test.sh [interpreter]
+
+interpreter=${1:-./interpreter}
+programs=(interpreter-test.input.*)
+if [ ! -x "$interpreter" ]; then
+    echo "$interpreter: not found" >&2
+    exit 2
+fi
+
+expected=$(mktemp)
+actual=$(mktemp)
+status=0
+for program in "${programs[@]}"; do
+    "$interpreter" < "$program" 2>/dev/null
+done > "$expected"
+for threads in 1 4; do
+    "$interpreter" --threads $threads --batch "${programs[@]}" \
+        > "$actual" 2>/dev/null
+    if ! cmp -s "$expected" "$actual"; then
+        echo "FAIL: --threads $threads --batch output differs"
+        diff "$expected" "$actual" | head -10
+        status=1
+    fi
+done
+rm -f "$expected" "$actual"
+[ $status = 0 ] && echo "batch output matches"
+exit $status
@@ -0,0 +1,33 @@
+;; Knuth's man or boy test, as in interpreter-test.input.26, plus curried
+;; closures: lots of closure creation and set! on captured variables
+(define A
+  (lambda (k x1 x2 x3 x4 x5)
+    (letrec ((B
+           (lambda ()
+             (begin
+               (set! k (- k 1))
+               (A k B x1 x2 x3 x4)))))
+      (if (<= k 0)
+          (+ (x4) (x5))
+          (B)))))
+
+(A 13 (lambda () 1) (lambda () -1)
+   (lambda () -1) (lambda () 1)
+   (lambda () 0))
+
+(define curry3
+  (lambda (fun)
+    (lambda (a)
+      (lambda (b)
+        (lambda (c)
+          (fun a b c))))))
+
+(define sum3 (lambda (a b c) (+ a b c)))
+
+(define loop
+  (lambda (i acc)
+    (if (= i 0)
+        acc
+        (loop (- i 1) (+ acc ((((curry3 sum3) 1) 2) 3))))))
+
+(loop 20000 0)
@@ -0,0 +1,48 @@
+;; Symbolic differentiation and simplification. There is no way to compare
+;; symbols yet, so expressions are tagged lists: (0 c) is a constant, (1) is
+;; the variable, (2 a b) is a sum and (3 a b) is a product.
+(define make-const (lambda (c) (cons 0 (cons c (quote ())))))
+(define make-var (lambda () (cons 1 (quote ()))))
+(define make-sum (lambda (a b) (cons 2 (cons a (cons b (quote ()))))))
+(define make-product (lambda (a b) (cons 3 (cons a (cons b (quote ()))))))
+
+(define tag (lambda (e) (car e)))
+(define left (lambda (e) (car (cdr e))))
+(define right (lambda (e) (car (cdr (cdr e)))))
+
+(define deriv
+  (lambda (e)
+    (cond
+      ((= (tag e) 0) (make-const 0))
+      ((= (tag e) 1) (make-const 1))
+      ((= (tag e) 2) (make-sum (deriv (left e)) (deriv (right e))))
+      (else (make-sum (make-product (left e) (deriv (right e)))
+                      (make-product (deriv (left e)) (right e)))))))
+
+;; Evaluates an expression at a point, to check the derivative
+(define value-at
+  (lambda (e x)
+    (cond
+      ((= (tag e) 0) (left e))
+      ((= (tag e) 1) x)
+      ((= (tag e) 2) (+ (value-at (left e) x) (value-at (right e) x)))
+      (else (* (value-at (left e) x) (value-at (right e) x))))))
+
+;; x^n built as a product of n copies of x, plus 3x
+(define power
+  (lambda (n)
+    (if (= n 1)
+        (make-var)
+        (make-product (make-var) (power (- n 1))))))
+
+(define poly
+  (lambda (n)
+    (make-sum (power n) (make-product (make-const 3) (make-var)))))
+
+(define repeat
+  (lambda (n result)
+    (if (= n 0)
+        result
+        (repeat (- n 1) (value-at (deriv (deriv (poly 8))) 2)))))
+
+(repeat 60 0)
@@ -0,0 +1,27 @@
+;; Counts the solutions to the 8 queens problem, with the queens placed so far
+;; kept in a list
+(define attacks?
+  (lambda (row dist placed)
+    (cond
+      ((null? placed) #f)
+      ((= (car placed) row) #t)
+      ((= (car placed) (+ row dist)) #t)
+      ((= (car placed) (- row dist)) #t)
+      (else (attacks? row (+ dist 1) (cdr placed))))))
+
+(define try-rows
+  (lambda (row n k placed)
+    (if (> row n)
+        0
+        (+ (if (attacks? row 1 placed)
+               0
+               (place (+ k 1) n (cons row placed)))
+           (try-rows (+ row 1) n k placed)))))
+
+(define place
+  (lambda (k n placed)
+    (if (> k n)
+        1
+        (try-rows 1 n k placed))))
+
+(place 1 8 (quote ()))
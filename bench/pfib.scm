@@ -0,0 +1,18 @@
+;; Doubly recursive Fibonacci with the first recursive call of each level
+;; above the cutoff run as a future, so it spreads across the worker threads.
+;; Compare with fib.scm, or run with --threads 1 for the sequential time.
+(define fib
+  (lambda (n)
+    (if (< n 2)
+        n
+        (+ (fib (- n 1)) (fib (- n 2))))))
+
+(define pfib
+  (lambda (n)
+    (if (< n 15)
+        (fib n)
+        (let ((left (future (lambda () (pfib (- n 1)))))
+              (right (pfib (- n 2))))
+          (+ (touch left) right)))))
+
+(pfib 25)
@@ -0,0 +1,51 @@
+;; Counts the solutions to the 8 queens problem as nqueens.scm does, with each
+;; choice of row for the first two queens searched in its own future
+(define attacks?
+  (lambda (row dist placed)
+    (cond
+      ((null? placed) #f)
+      ((= (car placed) row) #t)
+      ((= (car placed) (+ row dist)) #t)
+      ((= (car placed) (- row dist)) #t)
+      (else (attacks? row (+ dist 1) (cdr placed))))))
+
+(define try-rows
+  (lambda (row n k placed)
+    (if (> row n)
+        0
+        (+ (if (attacks? row 1 placed)
+               0
+               (place (+ k 1) n (cons row placed)))
+           (try-rows (+ row 1) n k placed)))))
+
+(define place
+  (lambda (k n placed)
+    (if (> k n)
+        1
+        (try-rows 1 n k placed))))
+
+;; Like try-rows, but starts a future for each row and then adds up their
+;; results
+(define spawn-rows
+  (lambda (row n k placed)
+    (if (> row n)
+        (quote ())
+        (cons (future (lambda ()
+                        (if (attacks? row 1 placed)
+                            0
+                            (pplace (+ k 1) n (cons row placed)))))
+              (spawn-rows (+ row 1) n k placed)))))
+
+(define touch-all
+  (lambda (futures)
+    (if (null? futures)
+        0
+        (+ (touch (car futures)) (touch-all (cdr futures))))))
+
+(define pplace
+  (lambda (k n placed)
+    (if (> k 2)
+        (place k n placed)
+        (touch-all (spawn-rows 1 n k placed)))))
+
+(pplace 1 8 (quote ()))
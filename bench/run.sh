@@ -0,0 +1,107 @@
+#!/bin/bash
+# run.sh - Runs every bench/*.scm program several times through the
+# interpreter and reports median and 95th percentile wall time, peak RSS and
+# allocation count for each. Optionally saves the results as a baseline, or
+# compares them with a saved baseline and flags regressions.
+#
+# The programs that make futures are then run again with --repeat, a few
+# times and many times over, to check that memory is freed between
+# iterations: peak RSS shouldn't grow by more than half.
+#
+# Usage: bench/run.sh [-n runs] [-s save-file] [-c baseline-file]
+#                     [-t threshold-percent] [interpreter]
+
+runs=5
+save=""
+compare=""
+threshold=10
+while getopts "n:s:c:t:" opt; do
+    case $opt in
+        n) runs=$OPTARG ;;
+        s) save=$OPTARG ;;
+        c) compare=$OPTARG ;;
+        t) threshold=$OPTARG ;;
+        *) echo "usage: $0 [-n runs] [-s save-file] [-c baseline-file]" \
+                "[-t threshold-percent] [interpreter]" >&2
+           exit 2 ;;
+    esac
+done
+shift $((OPTIND - 1))
+interpreter=${1:-./interpreter}
+dir=$(dirname "$0")
+
+results=$(mktemp)
+status=0
+
+printf "%-12s %10s %10s %10s %12s  %s\n" \
+    "benchmark" "median ms" "p95 ms" "RSS KB" "allocs" "vs baseline"
+for program in "$dir"/*.scm; do
+    name=$(basename "$program" .scm)
+    expected="$dir/$name.output"
+
+    # Wall time of each run, in milliseconds, sorted
+    times=()
+    wrong=""
+    for ((i = 0; i < runs; i++)); do
+        start=$(date +%s%N)
+        output=$("$interpreter" < "$program")
+        end=$(date +%s%N)
+        times+=($(( (end - start) / 1000000 )))
+        if [ -f "$expected" ] && [ "$output" != "$(cat "$expected")" ]; then
+            wrong="WRONG OUTPUT"
+            status=1
+        fi
+    done
+    sorted=($(printf "%s\n" "${times[@]}" | sort -n))
+    median=${sorted[$(( (runs - 1) / 2 ))]}
+    p95=${sorted[$(( (runs * 95 + 99) / 100 - 1 ))]}
+
+    # One more run with allocation statistics, for peak RSS and allocations
+    stats=$("$interpreter" --alloc-stats < "$program" 2>&1 >/dev/null)
+    allocs=$(echo "$stats" | awk '$4 == "(total)" { print $1 }')
+    rss=$(echo "$stats" | awk '/^peak RSS:/ { print $3 }')
+
+    note="$wrong"
+    if [ -n "$compare" ] && [ -f "$compare" ]; then
+        base=$(awk -v name="$name" '$1 == name { print $2 }' "$compare")
+        if [ -n "$base" ]; then
+            change=$(awk -v now="$median" -v base="$base" \
+                'BEGIN { if (base == 0) base = 1; printf "%+.1f%%", (now - base) * 100 / base }')
+            note="$change $note"
+            if awk -v now="$median" -v base="$base" -v t="$threshold" \
+                   'BEGIN { exit !(now > base * (1 + t / 100) && now - base > 2) }'; then
+                note="$note REGRESSION"
+                status=1
+            fi
+        fi
+    fi
+
+    printf "%-12s %10s %10s %10s %12s  %s\n" \
+        "$name" "$median" "$p95" "$rss" "$allocs" "$note"
+    echo "$name $median $p95 $rss $allocs" >> "$results"
+done
+
+echo
+printf "%-12s %10s %10s  %s\n" "repeated" "RSS KB x5" "RSS KB x20" "growth"
+for program in $(grep -l "(future" "$dir"/*.scm); do
+    name=$(basename "$program" .scm)
+    few=$("$interpreter" --threads 4 --alloc-stats --repeat 5 < "$program" \
+              2>&1 >/dev/null | awk '/^peak RSS:/ { print $3 }')
+    many=$("$interpreter" --threads 4 --alloc-stats --repeat 20 < "$program" \
+               2>&1 >/dev/null | awk '/^peak RSS:/ { print $3 }')
+    growth=$(awk -v few="$few" -v many="$many" \
+        'BEGIN { if (few == 0) few = 1; printf "%+.1f%%", (many - few) * 100 / few }')
+    note=""
+    if awk -v few="$few" -v many="$many" 'BEGIN { exit !(many > few * 1.5) }'; then
+        note="LEAK"
+        status=1
+    fi
+    printf "%-12s %10s %10s  %s %s\n" "$name" "$few" "$many" "$growth" "$note"
+done
+
+if [ -n "$save" ]; then
+    { echo "# benchmark median-ms p95-ms rss-kb allocs"; cat "$results"; } > "$save"
+    echo "Saved baseline to $save"
+fi
+rm -f "$results"
+exit $status
@@ -0,0 +1,54 @@
+;; Merge sort of a scrambled list of 2000 numbers
+(define wrap
+  (lambda (x n)
+    (if (< x n)
+        x
+        (wrap (- x n) n))))
+
+;; n numbers stepping by 919 around [0, 2003)
+(define scrambled
+  (lambda (x n acc)
+    (if (= n 0)
+        acc
+        (scrambled (wrap (+ x 919) 2003) (- n 1) (cons x acc)))))
+
+(define split-odds
+  (lambda (lst)
+    (if (null? lst)
+        (quote ())
+        (if (null? (cdr lst))
+            lst
+            (cons (car lst) (split-odds (cdr (cdr lst))))))))
+
+(define split-evens
+  (lambda (lst)
+    (if (null? lst)
+        (quote ())
+        (split-odds (cdr lst)))))
+
+(define merge
+  (lambda (a b)
+    (cond
+      ((null? a) b)
+      ((null? b) a)
+      ((< (car a) (car b)) (cons (car a) (merge (cdr a) b)))
+      (else (cons (car b) (merge a (cdr b)))))))
+
+(define merge-sort
+  (lambda (lst)
+    (if (null? lst)
+        lst
+        (if (null? (cdr lst))
+            lst
+            (merge (merge-sort (split-odds lst))
+                   (merge-sort (split-evens lst)))))))
+
+(define last
+  (lambda (lst)
+    (if (null? (cdr lst))
+        (car lst)
+        (last (cdr lst)))))
+
+(define sorted (merge-sort (scrambled 0 2000 (quote ()))))
+(car sorted)
+(last sorted)
@@ -0,0 +1,41 @@
+;; String building. There are no string primitives yet, so this builds a rope:
+;; a list of string pieces, repeatedly appended and reversed.
+(define append
+  (lambda (a b)
+    (if (null? a)
+        b
+        (cons (car a) (append (cdr a) b)))))
+
+(define reverse-rope
+  (lambda (rope acc)
+    (if (null? rope)
+        acc
+        (reverse-rope (cdr rope) (cons (car rope) acc)))))
+
+(define piece
+  (lambda (i)
+    (cond
+      ((= i 0) "alpha")
+      ((= i 1) "beta")
+      ((= i 2) "gamma")
+      (else "delta"))))
+
+(define build
+  (lambda (i n rope)
+    (if (= i n)
+        rope
+        (build (+ i 1) n (append rope (cons (piece (wrap i 4)) (quote ())))))))
+
+(define wrap
+  (lambda (x n)
+    (if (< x n)
+        x
+        (wrap (- x n) n))))
+
+(define rope-length
+  (lambda (rope n)
+    (if (null? rope)
+        n
+        (rope-length (cdr rope) (+ n 1)))))
+
+(rope-length (reverse-rope (build 0 400 (quote ())) (quote ())) 0)
@@ -0,0 +1,100 @@
+/* bytevector.c - Byte arrays, made in the heap or mapped from files         */
+/* By Tore Banta & Charlie Sarano                                            */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "value.h"
+#include "talloc.h"
+#include "bytevector.h"
+
+Value *makeBytevector(size_t length) {
+    // The bytes follow the Value and its Bytevector in the same block
+    Value *value = talloc(sizeof(Value) + sizeof(struct Bytevector) + length);
+    value->type = BYTEVECTOR_TYPE;
+    value->bytevector = (struct Bytevector *) (value + 1);
+    value->bytevector->data = (unsigned char *) (value->bytevector + 1);
+    value->bytevector->length = length;
+    value->bytevector->readOnly = 0;
+    value->bytevector->mapping = NULL;
+    memset(value->bytevector->data, 0, length);
+    return value;
+}
+
+Value *mappedBytevector(struct Mapping *mapping) {
+    Value *value = talloc(sizeof(Value) + sizeof(struct Bytevector));
+    value->type = BYTEVECTOR_TYPE;
+    value->bytevector = (struct Bytevector *) (value + 1);
+    value->bytevector->data = mapping->data;
+    value->bytevector->length = mapping->length;
+    value->bytevector->readOnly = 1;
+    value->bytevector->mapping = mapping;
+    return value;
+}
+
+// Unmaps a file once no heap refers to it
+void unmapFile(Shared *shared) {
+    struct Mapping *mapping = (struct Mapping *) shared;
+    if (mapping->length > 0) {
+        munmap(mapping->data, mapping->length);
+    }
+    free(mapping);
+}
+
+Value *mapFile(char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || !S_ISREG(status.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+    size_t length = status.st_size;
+    unsigned char *data = NULL;
+    // An empty file can't be mapped, and needs no bytes anyway
+    if (length > 0) {
+        data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return NULL;
+        }
+    }
+    // The mapping stays after the file is closed
+    close(fd);
+    struct Mapping *mapping = malloc(sizeof(struct Mapping));
+    if (mapping == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        texit(1);
+    }
+    mapping->shared.refs = 0;
+    mapping->shared.free = unmapFile;
+    mapping->data = data;
+    mapping->length = length;
+    Value *value = mappedBytevector(mapping);
+    tshare(&mapping->shared);
+    return value;
+}
+
+unsigned long readBytes(unsigned char *bytes, int size, int bigEndian) {
+    unsigned long value = 0;
+    for (int i = 0; i < size; i++) {
+        int byte = bigEndian ? i : size - 1 - i;
+        value = (value << 8) | bytes[byte];
+    }
+    return value;
+}
+
+void writeBytes(unsigned char *bytes, int size, int bigEndian,
+                unsigned long value) {
+    for (int i = 0; i < size; i++) {
+        int byte = bigEndian ? size - 1 - i : i;
+        bytes[byte] = value & 0xff;
+        value >>= 8;
+    }
+}
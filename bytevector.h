@@ -0,0 +1,54 @@
+#include <stddef.h>
+#include "value.h"
+#include "talloc.h"
+
+#ifndef _BYTEVECTOR
+#define _BYTEVECTOR
+
+// Bytevectors: fixed length arrays of bytes, for binary data. (make-bytevector
+// k [fill]) makes one of k bytes, and (file->bytevector path) maps a whole file
+// into memory read-only, so that reading it copies nothing and only the pages
+// used are read from disk. Besides single bytes, the bytes at an index can be
+// read and written as a 16 or 32 bit integer, signed or not, or as a single or
+// double precision float, in the byte order given by the symbol little or big.
+//
+// Mapped bytevectors can't be changed, and are passed to actors as they are
+// rather than copied. A mapped file stays mapped until every heap holding a
+// bytevector of it has been freed.
+struct Mapping {
+    Shared shared;
+    unsigned char *data;
+    size_t length;
+};
+
+// mapping is the file the bytes are mapped from, if readOnly is set
+struct Bytevector {
+    unsigned char *data;
+    size_t length;
+    int readOnly;
+    struct Mapping *mapping;
+};
+
+// Makes a bytevector of length bytes, all zero, in one allocation with its
+// Value
+Value *makeBytevector(size_t length);
+
+// Makes a read-only bytevector of the contents of the file at path, or
+// returns NULL if it can't be opened and mapped
+Value *mapFile(char *path);
+
+// Makes a read-only bytevector Value for a mapping made by mapFile. The
+// caller sees to it that the calling thread's heap holds a reference to the
+// mapping.
+Value *mappedBytevector(struct Mapping *mapping);
+
+// Reads size bytes starting at bytes as an unsigned integer, most significant
+// byte first if bigEndian is set and last otherwise
+unsigned long readBytes(unsigned char *bytes, int size, int bigEndian);
+
+// Writes the low size bytes of value starting at bytes, in the same order
+// readBytes reads them
+void writeBytes(unsigned char *bytes, int size, int bigEndian,
+                unsigned long value);
+
+#endif
@@ -0,0 +1,417 @@
+/* future.c - Futures on a work-stealing thread pool                        */
+/* By Tore Banta & Charlie Sarano                                            */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include "value.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "future.h"
+
+// Slots in each thread's deque. A future made when its maker's deque is full
+// is run on the spot instead.
+#define DEQUE_SIZE 8192
+
+// Stack given to each worker thread
+#define WORKER_STACK_SIZE (8 * 1024 * 1024)
+
+// Times an idle worker looks for work, yielding in between, before sleeping
+#define IDLE_SPINS 64
+
+#define MAX_WORKERS 255
+
+// A Chase-Lev deque, as given for C11 atomics by Le, Pop, Cohen and Zappa
+// Nardelli. The owner pushes and takes at bottom; other threads steal at top.
+typedef struct Deque {
+    long top;
+    char pad[56]; // keeps top and bottom on separate cache lines
+    long bottom;
+    struct Future *slots[DEQUE_SIZE];
+} Deque;
+
+int futureThreads = 0;
+
+// Deque 0 belongs to the thread that started the pool, the rest to the
+// workers. Other threads, such as those of a program embedding interpreters,
+// have no deque; they run the futures they make at once, and only steal.
+Deque *deques = NULL;
+int threadCount = 0;
+__thread int threadIndex = -1;
+
+// Futures in a deque, and futures not yet done
+long queued = 0;
+long unfinished = 0;
+
+// The futures the thread is running, innermost first, linked through outer
+__thread struct Future *runningFuture = NULL;
+
+// Where the futures the thread makes are counted until done: futureCount
+// while it is set, by an Interp or by the future being run, and otherwise the
+// thread's own count
+__thread long *futureCount = NULL;
+__thread long threadUnfinished = 0;
+
+long *currentCount() {
+    return futureCount != NULL ? futureCount : &threadUnfinished;
+}
+
+// Sleeping workers wait on wakeUp for queued to become nonzero, or for
+// heapRequest to change
+int idleWorkers = 0;
+pthread_mutex_t idleLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t wakeUp = PTHREAD_COND_INITIALIZER;
+
+// futureFreeHeaps asks the workers to free their heaps by adding one to
+// heapRequest. Each worker frees its heap between futures when it sees a
+// request it hasn't, then counts itself in heapsFreed.
+long heapRequest = 0;
+int heapsFreed = 0;
+pthread_mutex_t heapLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Adds a future to the bottom of the calling thread's deque, returning 0 if it
+// is full
+int dequePush(Deque *deque, struct Future *future) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= DEQUE_SIZE) {
+        return 0;
+    }
+    __atomic_store_n(&deque->slots[bottom % DEQUE_SIZE], future,
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// Removes the future at the bottom of the calling thread's deque, or returns
+// NULL if it is empty
+struct Future *dequeTake(Deque *deque) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    if (top > bottom) {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    struct Future *future = __atomic_load_n(&deque->slots[bottom % DEQUE_SIZE],
+                                            __ATOMIC_RELAXED);
+    if (top == bottom) {
+        // The last one, which a thief may be taking too
+        if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            future = NULL;
+        }
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return future;
+}
+
+// Removes the future at the top of another thread's deque, or returns NULL if
+// it is empty or another thread got there first
+struct Future *dequeSteal(Deque *deque) {
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) {
+        return NULL;
+    }
+    struct Future *future = __atomic_load_n(&deque->slots[top % DEQUE_SIZE],
+                                            __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return future;
+}
+
+// Finds a future to run: the newest in the calling thread's deque, or else
+// the oldest in some other thread's, trying each once from a random start
+struct Future *findWork() {
+    struct Future *future = NULL;
+    if (threadIndex >= 0) {
+        future = dequeTake(&deques[threadIndex]);
+    }
+    if (future == NULL && threadCount > 1) {
+        static __thread unsigned int seed = 0;
+        if (seed == 0) {
+            seed = threadIndex * 2654435761U + 1;
+        }
+        seed = seed * 1103515245 + 12345;
+        int start = (seed >> 16) % threadCount;
+        for (int i = 0; i < threadCount && future == NULL; i++) {
+            int victim = (start + i) % threadCount;
+            if (victim != threadIndex) {
+                future = dequeSteal(&deques[victim]);
+            }
+        }
+    }
+    if (future != NULL) {
+        __atomic_fetch_sub(&queued, 1, __ATOMIC_SEQ_CST);
+    }
+    return future;
+}
+
+// Marks a future done, whether it finished or was abandoned
+void finishFuture(struct Future *future) {
+    long *count = future->count;
+    __atomic_store_n(&future->state, FUTURE_DONE, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(count, 1, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&unfinished, 1, __ATOMIC_RELEASE);
+}
+
+// Runs a future unless some thread has already claimed it. A future touched
+// before a worker reaches it is run by the toucher and left in the deque, so
+// it is claimed here rather than by taking it from the deque. While it runs,
+// its output goes where its maker's did, and the futures it makes are
+// counted with it.
+void runFuture(struct Future *future) {
+    int pending = FUTURE_PENDING;
+    if (!__atomic_compare_exchange_n(&future->state, &pending, FUTURE_RUNNING,
+                                     0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+    future->outer = runningFuture;
+    future->outerCount = futureCount;
+    future->outerOutput = outputFile;
+    runningFuture = future;
+    futureCount = future->count;
+    outputFile = future->output;
+    if (future->task != NULL) {
+        future->result = future->task(future->data);
+    }
+    else {
+        future->result = apply(future->thunk, 0, NULL);
+    }
+    runningFuture = future->outer;
+    futureCount = future->outerCount;
+    outputFile = future->outerOutput;
+    finishFuture(future);
+}
+
+void abandonFutures() {
+    while (runningFuture != NULL) {
+        struct Future *future = runningFuture;
+        runningFuture = future->outer;
+        futureCount = future->outerCount;
+        outputFile = future->outerOutput;
+        future->failed = 1;
+        finishFuture(future);
+    }
+}
+
+long *futureSetCount(long *count) {
+    long *previous = futureCount;
+    futureCount = count;
+    return previous;
+}
+
+// Body of each worker thread: run futures, and sleep when there are none
+void *workerMain(void *index) {
+    // Profiling samples go to the main thread, whose stack they describe
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    threadIndex = (long) index;
+    outputFile = stdout;
+    tallocThreadStart();
+    initStackLimit(WORKER_STACK_SIZE);
+
+    // An error in a future is reported to the future's maker's output, and
+    // ends just that future; its toucher finds it failed
+    jmp_buf trap;
+    void *stack_mark = smark();
+    volatile long request_seen = 0;
+    exitTrap = &trap;
+    if (setjmp(trap) != 0) {
+        resetEvaluator();
+        srelease(stack_mark);
+    }
+    int spins = 0;
+    while (1) {
+        long request = __atomic_load_n(&heapRequest, __ATOMIC_ACQUIRE);
+        if (request != request_seen) {
+            request_seen = request;
+            trelease(NULL);
+            __atomic_fetch_add(&heapsFreed, 1, __ATOMIC_RELEASE);
+        }
+        struct Future *future = findWork();
+        if (future != NULL) {
+            runFuture(future);
+            spins = 0;
+        }
+        else if (spins < IDLE_SPINS) {
+            spins++;
+            sched_yield();
+        }
+        else {
+            pthread_mutex_lock(&idleLock);
+            __atomic_fetch_add(&idleWorkers, 1, __ATOMIC_SEQ_CST);
+            while (__atomic_load_n(&queued, __ATOMIC_SEQ_CST) == 0 &&
+                   __atomic_load_n(&heapRequest, __ATOMIC_SEQ_CST) ==
+                   request_seen) {
+                pthread_cond_wait(&wakeUp, &idleLock);
+            }
+            __atomic_fetch_sub(&idleWorkers, 1, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&idleLock);
+            spins = 0;
+        }
+    }
+    return NULL;
+}
+
+// Starts the worker threads, once
+pthread_once_t poolStarted = PTHREAD_ONCE_INIT;
+
+void startPool() {
+    threadCount = futureThreads;
+    if (threadCount <= 0) {
+        threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threadCount < 1) {
+        threadCount = 1;
+    }
+    if (threadCount > MAX_WORKERS + 1) {
+        threadCount = MAX_WORKERS + 1;
+    }
+    // Lives as long as the workers do, so not talloc'd
+    deques = calloc(threadCount, sizeof(Deque));
+    if (deques == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        texit(1);
+    }
+    threadIndex = 0;
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, WORKER_STACK_SIZE);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    for (long i = 1; i < threadCount; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attributes, workerMain, (void *) i) != 0) {
+            // Run with the workers we have
+            threadCount = i;
+            break;
+        }
+    }
+    pthread_attr_destroy(&attributes);
+}
+
+int futurePoolSize() {
+    pthread_once(&poolStarted, startPool);
+    return threadCount;
+}
+
+// Schedules a new future on the calling thread's deque
+struct Future *schedule(Value *thunk, Value *(*task)(void *data), void *data) {
+    pthread_once(&poolStarted, startPool);
+    struct Future *future = talloc(sizeof(struct Future));
+    future->thunk = thunk;
+    future->task = task;
+    future->data = data;
+    future->result = NULL;
+    future->state = FUTURE_PENDING;
+    future->failed = 0;
+    future->count = currentCount();
+    future->output = outputFile;
+    __atomic_fetch_add(future->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&unfinished, 1, __ATOMIC_RELAXED);
+
+    if (threadIndex < 0 || !dequePush(&deques[threadIndex], future)) {
+        runFuture(future);
+        return future;
+    }
+    __atomic_fetch_add(&queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&idleWorkers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&idleLock);
+        pthread_cond_signal(&wakeUp);
+        pthread_mutex_unlock(&idleLock);
+    }
+    return future;
+}
+
+struct Future *makeFuture(Value *thunk) {
+    return schedule(thunk, NULL, NULL);
+}
+
+struct Future *makeTask(Value *(*task)(void *data), void *data) {
+    return schedule(NULL, task, data);
+}
+
+Value *touchFuture(struct Future *future) {
+    runFuture(future);
+    while (__atomic_load_n(&future->state, __ATOMIC_ACQUIRE) != FUTURE_DONE) {
+        struct Future *other = findWork();
+        if (other != NULL) {
+            runFuture(other);
+        }
+        else {
+            sched_yield();
+        }
+    }
+    if (future->failed) {
+        // The error has been reported by the thread that ran it
+        texit(1);
+    }
+    return future->result;
+}
+
+void futureWaitAll() {
+    if (deques == NULL) {
+        return;
+    }
+    long *count = currentCount();
+    while (__atomic_load_n(count, __ATOMIC_ACQUIRE) > 0) {
+        struct Future *other = findWork();
+        if (other != NULL) {
+            runFuture(other);
+        }
+        else {
+            sched_yield();
+        }
+    }
+    // Futures touched before a worker reached them are still in the deque of
+    // the thread that made them; they are taken out, so that no worker looks
+    // at one after its memory is freed
+    if (threadIndex >= 0) {
+        struct Future *future;
+        while ((future = dequeTake(&deques[threadIndex])) != NULL) {
+            __atomic_fetch_sub(&queued, 1, __ATOMIC_SEQ_CST);
+            runFuture(future);
+        }
+    }
+}
+
+void futureFreeHeaps() {
+    if (deques == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&heapLock);
+    // Every future, and every entry left in a deque
+    while (__atomic_load_n(&unfinished, __ATOMIC_ACQUIRE) > 0 ||
+           __atomic_load_n(&queued, __ATOMIC_ACQUIRE) > 0) {
+        struct Future *other = findWork();
+        if (other != NULL) {
+            runFuture(other);
+        }
+        else {
+            sched_yield();
+        }
+    }
+    pthread_mutex_lock(&idleLock);
+    heapsFreed = 0;
+    __atomic_fetch_add(&heapRequest, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&wakeUp);
+    pthread_mutex_unlock(&idleLock);
+    while (__atomic_load_n(&heapsFreed, __ATOMIC_ACQUIRE) < threadCount - 1) {
+        sched_yield();
+    }
+    pthread_mutex_unlock(&heapLock);
+}
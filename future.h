@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include "value.h"
+
+#ifndef _FUTURE
+#define _FUTURE
+
+// Futures: (future thunk) starts thunk running on a pool of worker threads and
+// returns at once, and (touch f) waits for and returns its result. Each thread
+// keeps a deque of the futures it has made; it works from the bottom of its
+// own deque, most recent first, and when that is empty steals the oldest
+// future from the top of another thread's. A thread that touches a future
+// nobody has started runs it itself, and while waiting for one that another
+// thread is running it runs other futures instead of blocking.
+//
+// The pool is started by the first future. Futures may call procedures,
+// build data and share hash tables and memoized procedures, which are
+// locked. A define inside a future binds in the procedure's frame, never
+// the global one; the global frame gains bindings only on the thread
+// running the program, and they, like set! on any variable, are published
+// with atomic stores so that futures reading them see whole bindings. set!
+// is not a lock, though: futures updating one variable can lose updates.
+
+#define FUTURE_PENDING 0
+#define FUTURE_RUNNING 1
+#define FUTURE_DONE 2
+
+// A future runs either thunk, a Scheme procedure, or for futures made from C
+// by makeTask, task(data). failed is set if it ended with an error. count is
+// the count of unfinished futures it is in, and output where its maker's
+// output went; the outer fields hold what the thread running it had before.
+struct Future {
+    Value *thunk;
+    Value *(*task)(void *data);
+    void *data;
+    Value *result;
+    int state;
+    int failed;
+    long *count;
+    FILE *output;
+    struct Future *outer;
+    long *outerCount;
+    FILE *outerOutput;
+};
+
+// Threads to run futures on, counting the main thread; set by --threads. Zero
+// means one per processor.
+extern int futureThreads;
+
+// Makes a future running the procedure thunk with no arguments
+struct Future *makeFuture(Value *thunk);
+
+// Makes a future that calls task(data)
+struct Future *makeTask(Value *(*task)(void *data), void *data);
+
+// Returns the number of threads futures run on, starting the pool if it
+// hasn't been already
+int futurePoolSize();
+
+// Returns the result of a future, waiting for it if necessary. If the future
+// ended with an error, which has been reported already, exits with texit.
+Value *touchFuture(struct Future *future);
+
+// Waits until every future the calling thread has made, counted as it
+// counts them now, has finished, so that memory they use can be freed
+void futureWaitAll();
+
+// Makes count where the futures the calling thread makes are counted, or the
+// thread's own count if NULL, and returns the count it replaces. Each Interp
+// has a count of its own, so that it only waits for its own futures.
+long *futureSetCount(long *count);
+
+// Marks the futures the calling thread was running done and failed, after an
+// error has abandoned them
+void abandonFutures();
+
+// Waits for every future to finish, then has each worker free everything it
+// has talloc'd, which is kept until then since a future's result and whatever
+// it refers to may be in the heap of the worker that ran it. Only for when
+// nothing made by a future so far is still in use, such as when a program
+// has ended and its heap is about to be freed.
+void futureFreeHeaps();
+
+#endif
@@ -0,0 +1,336 @@
+/* hashtable.c - Structural hash tables for use in interpreter project       */
+/* By Tore Banta & Charlie Sarano                                            */
+
+#include <string.h>
+#include <sched.h>
+#include "value.h"
+#include "talloc.h"
+#include "hashtable.h"
+
+#define INITIAL_CAPACITY 16
+
+// Only this many elements of a list are hashed; longer lists with the same
+// first elements share a hash and are told apart by valuesEqual
+#define HASH_MAX_ELEMENTS 32
+
+// Mixes the bits of a word so that nearby inputs give unrelated hashes
+unsigned long mixHash(unsigned long hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdUL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53UL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// FNV-1a hash of length characters
+unsigned long hashChars(char *s, size_t length) {
+    unsigned long hash = 0xcbf29ce484222325UL;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char) s[i]) * 0x100000001b3UL;
+    }
+    return hash;
+}
+
+// Checks whether a Value is an integer or a real number
+int isNumber(Value *value) {
+    return value->type == INT_TYPE || value->type == DOUBLE_TYPE;
+}
+
+// Returns the value of an integer or real number as a double
+double numberValue(Value *value) {
+    return value->type == INT_TYPE ? value->i : value->d;
+}
+
+// Returns a hash of value consistent with valuesEqual
+unsigned long hashValue(Value *value) {
+    unsigned long hash = value->type;
+    switch (value->type) {
+        case BOOL_TYPE:
+            hash += value->i;
+            break;
+        case INT_TYPE:
+        case DOUBLE_TYPE:
+            {
+            // Numbers hash by value, so 3 and 3.0 are the same key
+            double d = numberValue(value);
+            unsigned long bits;
+            d = d == 0 ? 0 : d; // -0.0 equals 0.0
+            memcpy(&bits, &d, sizeof(bits));
+            hash = DOUBLE_TYPE + bits;
+            break;
+            }
+        case STR_TYPE:
+            hash += hashChars(value->str.chars, value->str.length);
+            break;
+        case SYMBOL_TYPE:
+            hash += hashChars(value->s, strlen(value->s));
+            break;
+        case CONS_TYPE:
+            for (int i = 0; value->type == CONS_TYPE && i < HASH_MAX_ELEMENTS;
+                 i++) {
+                hash = hash * 31 + hashValue(value->c.car);
+                value = value->c.cdr;
+            }
+            if (value->type != CONS_TYPE) {
+                hash = hash * 31 + hashValue(value);
+            }
+            break;
+        case NULL_TYPE:
+        case VOID_TYPE:
+            break;
+        default:
+            hash += (unsigned long) value;
+            break;
+    }
+    return mixHash(hash);
+}
+
+// Checks whether two Values have the same type and contents
+int valuesEqual(Value *a, Value *b) {
+    while (a != b) {
+        if (isNumber(a) && isNumber(b)) {
+            return numberValue(a) == numberValue(b);
+        }
+        if (a->type != b->type) {
+            return 0;
+        }
+        switch (a->type) {
+            case BOOL_TYPE:
+                return a->i == b->i;
+            case STR_TYPE:
+                return a->str.length == b->str.length &&
+                       memcmp(a->str.chars, b->str.chars, a->str.length) == 0;
+            case SYMBOL_TYPE:
+                return strcmp(a->s, b->s) == 0;
+            case NULL_TYPE:
+            case VOID_TYPE:
+                return 1;
+            case CONS_TYPE:
+                if (!valuesEqual(a->c.car, b->c.car)) {
+                    return 0;
+                }
+                // Loops down the rest of the lists
+                a = a->c.cdr;
+                b = b->c.cdr;
+                break;
+            default:
+                return 0;
+        }
+    }
+    return 1;
+}
+
+// Hashes and compares keys the way the table's mode says
+unsigned long hashKey(HashTable *table, Value *key) {
+    if (table->mode == HASH_EQ && key->type != INT_TYPE &&
+        key->type != DOUBLE_TYPE && key->type != BOOL_TYPE &&
+        key->type != SYMBOL_TYPE && key->type != NULL_TYPE) {
+        return mixHash((unsigned long) key);
+    }
+    return hashValue(key);
+}
+
+int keysEqual(HashTable *table, Value *a, Value *b) {
+    if (table->mode == HASH_EQ && a->type != INT_TYPE &&
+        a->type != DOUBLE_TYPE && a->type != BOOL_TYPE &&
+        a->type != SYMBOL_TYPE && a->type != NULL_TYPE) {
+        return a == b;
+    }
+    return valuesEqual(a, b);
+}
+
+// Marks an entry whose key was removed. Probing carries on past it, since the
+// key being looked for may have been placed further along before the removal.
+Value tombstone;
+
+// Makes an array of capacity empty entries
+HashEntry *makeEntries(unsigned long capacity) {
+    HashEntry *entries = talloc(sizeof(HashEntry) * capacity);
+    memset(entries, 0, sizeof(HashEntry) * capacity);
+    return entries;
+}
+
+HashTable *makeHashTable(hashMode mode) {
+    HashTable *table = talloc(sizeof(HashTable));
+    table->mode = mode;
+    table->capacity = INITIAL_CAPACITY;
+    table->entries = makeEntries(INITIAL_CAPACITY);
+    table->used = 0;
+    table->count = 0;
+    table->oldEntries = NULL;
+    table->oldCapacity = 0;
+    table->migrated = 0;
+    table->lock = 0;
+    return table;
+}
+
+// Returns the entry for key in an array of entries, or NULL if it isn't
+// there. Entries are found by linear probing from the slot the hash picks.
+HashEntry *findEntry(HashTable *table, HashEntry *entries,
+                     unsigned long capacity, Value *key, unsigned long hash) {
+    unsigned long mask = capacity - 1;
+    for (unsigned long slot = hash & mask; ; slot = (slot + 1) & mask) {
+        HashEntry *entry = &entries[slot];
+        if (entry->key == NULL) {
+            return NULL;
+        }
+        if (entry->key != &tombstone && entry->hash == hash &&
+            keysEqual(table, entry->key, key)) {
+            return entry;
+        }
+    }
+}
+
+// Returns the entry to put a new key in: the first empty or removed one
+// along its probe sequence
+HashEntry *freeEntry(HashEntry *entries, unsigned long capacity,
+                     unsigned long hash) {
+    unsigned long mask = capacity - 1;
+    unsigned long slot = hash & mask;
+    while (entries[slot].key != NULL && entries[slot].key != &tombstone) {
+        slot = (slot + 1) & mask;
+    }
+    return &entries[slot];
+}
+
+// Moves up to HASH_MIGRATE_STEP slots' worth of entries from the old array
+// of a growing table to the new one
+#define HASH_MIGRATE_STEP 8
+
+void migrateSome(HashTable *table) {
+    if (table->oldEntries == NULL) {
+        return;
+    }
+    for (int i = 0; i < HASH_MIGRATE_STEP &&
+         table->migrated < table->oldCapacity; i++) {
+        HashEntry *entry = &table->oldEntries[table->migrated++];
+        if (entry->key != NULL && entry->key != &tombstone) {
+            *freeEntry(table->entries, table->capacity, entry->hash) = *entry;
+            table->used++;
+            // Other keys may have probed past this slot
+            entry->key = &tombstone;
+        }
+    }
+    if (table->migrated == table->oldCapacity) {
+        // The old array is left for tfree
+        table->oldEntries = NULL;
+    }
+}
+
+// Finishes moving entries from the old array, for the rare case of growing
+// again before the last growth is done
+void migrateAll(HashTable *table) {
+    while (table->oldEntries != NULL) {
+        migrateSome(table);
+    }
+}
+
+// Starts moving the entries of a table into a new array, twice as big unless
+// most of the used slots are only removed entries
+void growTable(HashTable *table) {
+    migrateAll(table);
+    unsigned long capacity = table->capacity;
+    if ((table->count + 1) * 2 > capacity) {
+        capacity *= 2;
+    }
+    table->oldEntries = table->entries;
+    table->oldCapacity = table->capacity;
+    table->migrated = 0;
+    table->entries = makeEntries(capacity);
+    table->capacity = capacity;
+    table->used = 0;
+}
+
+// Returns the entry for key in either array, or NULL
+HashEntry *lookUp(HashTable *table, Value *key, unsigned long hash) {
+    HashEntry *entry = findEntry(table, table->entries, table->capacity, key,
+                                 hash);
+    if (entry == NULL && table->oldEntries != NULL) {
+        entry = findEntry(table, table->oldEntries, table->oldCapacity, key,
+                          hash);
+    }
+    return entry;
+}
+
+void hashLock(HashTable *table) {
+    while (__atomic_exchange_n(&table->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&table->lock, __ATOMIC_RELAXED)) {
+            sched_yield();
+        }
+    }
+}
+
+void hashUnlock(HashTable *table) {
+    __atomic_store_n(&table->lock, 0, __ATOMIC_RELEASE);
+}
+
+Value *hashGet(HashTable *table, Value *key) {
+    hashLock(table);
+    migrateSome(table);
+    HashEntry *entry = lookUp(table, key, hashKey(table, key));
+    Value *value = entry != NULL ? entry->value : NULL;
+    hashUnlock(table);
+    return value;
+}
+
+void hashPut(HashTable *table, Value *key, Value *value) {
+    hashLock(table);
+    migrateSome(table);
+    unsigned long hash = hashKey(table, key);
+    HashEntry *entry = lookUp(table, key, hash);
+    if (entry != NULL) {
+        entry->value = value;
+        hashUnlock(table);
+        return;
+    }
+    // Kept at most three quarters full, counting removed entries, so probe
+    // sequences stay short
+    if ((table->used + 1) * 4 > table->capacity * 3) {
+        growTable(table);
+    }
+    entry = freeEntry(table->entries, table->capacity, hash);
+    if (entry->key == NULL) {
+        table->used++;
+    }
+    entry->hash = hash;
+    entry->key = key;
+    entry->value = value;
+    table->count++;
+    hashUnlock(table);
+}
+
+void hashRemove(HashTable *table, Value *key) {
+    hashLock(table);
+    migrateSome(table);
+    HashEntry *entry = lookUp(table, key, hashKey(table, key));
+    if (entry != NULL) {
+        entry->key = &tombstone;
+        entry->value = NULL;
+        table->count--;
+    }
+    hashUnlock(table);
+}
+
+HashEntry *hashNext(HashTable *table, unsigned long *position) {
+    // Positions count through the unmoved part of the old array, then the
+    // new array
+    unsigned long old_slots = 0;
+    if (table->oldEntries != NULL) {
+        old_slots = table->oldCapacity;
+    }
+    while (*position < old_slots + table->capacity) {
+        HashEntry *entry;
+        if (*position < old_slots) {
+            entry = &table->oldEntries[*position];
+        }
+        else {
+            entry = &table->entries[*position - old_slots];
+        }
+        (*position)++;
+        if (entry->key != NULL && entry->key != &tombstone) {
+            return entry;
+        }
+    }
+    return NULL;
+}
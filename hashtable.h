@@ -0,0 +1,71 @@
+#include "value.h"
+
+#ifndef _HASHTABLE
+#define _HASHTABLE
+
+// Hash tables from Values to Values, used for memoization and for the hash
+// tables Scheme programs make with make-hash-table. A table compares keys in
+// one of two ways:
+//  - HASH_EQUAL compares by structure, so lists with equal elements are one
+//    key.
+//  - HASH_EQ compares numbers, booleans and symbols by value but everything
+//    else (lists, strings, procedures) by identity, like eqv?.
+typedef enum {HASH_EQUAL, HASH_EQ} hashMode;
+
+typedef struct HashEntry {
+    unsigned long hash;
+    Value *key;
+    Value *value;
+} HashEntry;
+
+// When a table grows, its entries are moved to the bigger array a few at a
+// time by each later operation instead of all at once, so no single insert
+// has to rehash the whole table. Until that's done, oldEntries holds the
+// entries not yet moved, and lookups search both arrays.
+//
+// Futures running in parallel may share a table, so every operation, even a
+// lookup, which moves entries too, holds the table's lock.
+typedef struct HashTable {
+    hashMode mode;
+    HashEntry *entries;
+    unsigned long capacity;
+    unsigned long used;
+    unsigned long count;
+    HashEntry *oldEntries;
+    unsigned long oldCapacity;
+    unsigned long migrated;
+    int lock;
+} HashTable;
+
+// Returns a hash of value consistent with valuesEqual
+unsigned long hashValue(Value *value);
+
+// Checks whether two Values have the same type and contents, comparing lists
+// element by element. Integers and reals are compared by numeric value, as =
+// does, since arithmetic here gives reals even on integer arguments.
+// Procedures are only equal to themselves.
+int valuesEqual(Value *a, Value *b);
+
+// Makes a new empty table. Tables are talloc'd and live until tfree.
+HashTable *makeHashTable(hashMode mode);
+
+// Returns the value stored under key, or NULL if there isn't one
+Value *hashGet(HashTable *table, Value *key);
+
+// Stores value under key, replacing any value already there
+void hashPut(HashTable *table, Value *key, Value *value);
+
+// Removes key and its value from the table, if it is there
+void hashRemove(HashTable *table, Value *key);
+
+// Iterates over the entries of a table: start with *position at 0, and each
+// call returns the next entry, or NULL when there are no more. The table
+// must not be changed during the iteration, so the caller holds its lock
+// with hashLock throughout.
+HashEntry *hashNext(HashTable *table, unsigned long *position);
+
+// Takes and gives back a table's lock, which is not recursive
+void hashLock(HashTable *table);
+void hashUnlock(HashTable *table);
+
+#endif
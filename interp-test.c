@@ -0,0 +1,131 @@
+/* interp-test.c - Tests of the embedding interface in scheme.h             */
+/* By Tore Banta & Charlie Sarano                                            */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "scheme.h"
+
+// Each check evaluates source in an Interp whose output goes to a memory
+// stream, and compares the status and what was printed with those expected;
+// a NULL expected output means the output isn't checked
+int failures = 0;
+
+void check(Interp *interp, const char *source, int status,
+           const char *expected) {
+    char *output = NULL;
+    size_t size = 0;
+    FILE *stream = open_memstream(&output, &size);
+    interp_set_output(interp, stream);
+    int result = interp_eval_string(interp, source);
+    fclose(stream);
+    int passed = result == status &&
+                 (expected == NULL || strcmp(output, expected) == 0);
+    if (!passed) {
+        fprintf(stderr, "FAIL: %s\n  returned %d, expected %d\n", source,
+                result, status);
+        fprintf(stderr, "  printed \"%s\"\n", output);
+        if (expected != NULL) {
+            fprintf(stderr, "  expected \"%s\"\n", expected);
+        }
+        __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+    }
+    free(output);
+}
+
+// Definitions made by one call are seen by later calls on the same Interp
+void testPersistence() {
+    Interp *interp = interp_new();
+    check(interp, "(define x 5)", 0, "");
+    check(interp, "(define add-x (lambda (y) (+ x y)))", 0, "");
+    check(interp, "(add-x 2)", 0, "7.000000\n");
+    interp_free(interp);
+}
+
+// Each Interp has its own globals
+void testIsolation() {
+    Interp *a = interp_new();
+    Interp *b = interp_new();
+    check(a, "(define x 1)", 0, "");
+    check(b, "(define x 2)", 0, "");
+    check(a, "x", 0, "1\n");
+    check(b, "x", 0, "2\n");
+    check(a, "(define only-a 3)", 0, "");
+    check(b, "only-a", -1,
+          "Evaluation error: Symbol being evaluated doesn't have a bound "
+          "value\n");
+    interp_free(a);
+    check(b, "x", 0, "2\n");
+    interp_free(b);
+}
+
+// An error ends the call, not the Interp: what was defined before it stays
+void testRecovery() {
+    Interp *interp = interp_new();
+    check(interp, "(define x 5)", 0, "");
+    check(interp, "(car x)", -1,
+          "Evaluation error: Car and Cdr require a list as an argument\n");
+    check(interp, "x (car 5) (quote unreached)", -1,
+          "5\nEvaluation error: Car and Cdr require a list as an argument\n");
+    check(interp, "(+ x 1", -1, NULL);
+    check(interp, "(define deep (lambda (n) (if (= n 0) 0 (+ 1 (deep (- n "
+                  "1))))))", 0, "");
+    check(interp, "(deep 100000000)", -1,
+          "Evaluation error: Maximum recursion depth exceeded\n");
+    check(interp, "(deep 10)", 0, "10.000000\n");
+    interp_free(interp);
+}
+
+// An error inside a future makes the call touching it fail, wherever the
+// future ran, and leaves the Interp and its other futures usable
+void testFutureErrors() {
+    Interp *interp = interp_new();
+    check(interp, "(touch (future (lambda () (car 5))))", -1,
+          "Evaluation error: Car and Cdr require a list as an argument\n");
+    check(interp, "(touch (future (lambda () (+ 1 2))))", 0, "3.000000\n");
+    check(interp, "(touch (future (lambda () (touch (future (lambda () (car "
+                  "5)))))))", -1,
+          "Evaluation error: Car and Cdr require a list as an argument\n");
+    check(interp, "(define good (future (lambda () 4)))", 0, "");
+    check(interp, "(touch good)", 0, "4\n");
+    interp_free(interp);
+}
+
+// Interps on different threads at once
+void *runOnThread(void *data) {
+    Interp *interp = interp_new();
+    check(interp, "(define sum (lambda (n) (if (= n 0) 0 (+ n (sum (- n "
+                  "1))))))", 0, "");
+    for (int i = 0; i < 20; i++) {
+        check(interp, "(touch (future (lambda () (sum 100))))", 0,
+              "5050.000000\n");
+        check(interp, "(touch (future (lambda () (car 5))))", -1, NULL);
+    }
+    interp_free(interp);
+    return NULL;
+}
+
+void testThreads() {
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&threads[i], NULL, runOnThread, NULL);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+int main() {
+    testPersistence();
+    testIsolation();
+    testRecovery();
+    testFutureErrors();
+    testThreads();
+    if (failures > 0) {
+        printf("%d interp tests failed\n", failures);
+        return 1;
+    }
+    printf("interp tests pass\n");
+    return 0;
+}
@@ -0,0 +1,132 @@
+/* interp.c - Interpreter instances for programs embedding the interpreter   */
+/* By Tore Banta & Charlie Sarano                                            */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include "value.h"
+#include "talloc.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "optimizer.h"
+#include "interpreter.h"
+#include "future.h"
+#include "actor.h"
+#include "scheme.h"
+
+// An interpreter instance: the allocation list holding everything made while
+// evaluating in it, its global frame, and the count of its futures not yet
+// done. The heap is the calling thread's allocation list only for the
+// duration of a call.
+struct Interp {
+    void *heap;
+    Frame *global;
+    FILE *output;
+    long futures;
+};
+
+// Interpreters not yet freed. When the last is freed, nothing made by a
+// future is in use any more, so the workers' heaps are freed too; interpLock
+// keeps a new interpreter from starting futures meanwhile.
+int liveInterps = 0;
+pthread_mutex_t interpLock = PTHREAD_MUTEX_INITIALIZER;
+
+Interp *interp_new() {
+    Interp *interp = malloc(sizeof(Interp));
+    if (interp == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&interpLock);
+    liveInterps++;
+    pthread_mutex_unlock(&interpLock);
+    void *previous = tswitch(NULL);
+    interp->global = makeGlobalFrame();
+    interp->heap = tswitch(previous);
+    interp->output = stdout;
+    interp->futures = 0;
+    return interp;
+}
+
+void interp_set_output(Interp *interp, FILE *output) {
+    interp->output = output;
+}
+
+// Evaluates the program read from input in the interpreter, optimizing it
+// first if asked to, and returns 0 or -1 as interp_eval_string does
+int evalInput(Interp *interp, FILE *input, int optimizing) {
+    void *previous_heap = tswitch(interp->heap);
+    FILE *previous_output = outputFile;
+    jmp_buf *previous_trap = exitTrap;
+    long *previous_count = futureSetCount(&interp->futures);
+    void *stack_mark = smark();
+    jmp_buf trap;
+    int status = 0;
+
+    outputFile = interp->output;
+    exitTrap = &trap;
+    if (setjmp(trap) == 0) {
+        Value *tree = parse(tokenize(input));
+        if (optimizing) {
+            tree = optimize(tree);
+        }
+        interpretIn(tree, interp->global, 1);
+    }
+    else {
+        // Reached through texit, from wherever the error was found
+        resetEvaluator();
+        srelease(stack_mark);
+        futureWaitAll();
+        status = -1;
+    }
+
+    exitTrap = previous_trap;
+    futureSetCount(previous_count);
+    outputFile = previous_output;
+    interp->heap = tswitch(previous_heap);
+    return status;
+}
+
+int interp_eval_string(Interp *interp, const char *source) {
+    // The tokenizer needs a delimiter after the last token, which a file
+    // normally ends with but a string may not
+    size_t length = strlen(source);
+    char *text = malloc(length + 2);
+    if (text == NULL) {
+        return -1;
+    }
+    memcpy(text, source, length);
+    text[length] = '\n';
+    text[length + 1] = '\0';
+    FILE *input = fmemopen(text, length + 1, "r");
+    if (input == NULL) {
+        free(text);
+        return -1;
+    }
+    int status = evalInput(interp, input, 0);
+    fclose(input);
+    free(text);
+    return status;
+}
+
+int interp_eval_program(Interp *interp, FILE *input) {
+    return evalInput(interp, input, 1);
+}
+
+void interp_free(Interp *interp) {
+    // Futures may still be using the heap
+    long *previous_count = futureSetCount(&interp->futures);
+    futureWaitAll();
+    futureSetCount(previous_count);
+    void *previous = tswitch(interp->heap);
+    trelease(NULL);
+    tswitch(previous);
+    free(interp);
+    pthread_mutex_lock(&interpLock);
+    liveInterps--;
+    if (liveInterps == 0 && !actorsRunning()) {
+        futureFreeHeaps();
+    }
+    pthread_mutex_unlock(&interpLock);
+}
@@ -1,69 +1,93 @@
 /* interpreter.c - Program for interpreting Scheme code using C              */
 /* By Tore Banta & Charlie Sarano                                            */
 
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ucontext.h>
+#include <pthread.h>
 #include "linkedlist.h"
 #include "talloc.h"
 #include "interpreter.h"
 #include "value.h"
 #include "parser.h"
+#include "profiler.h"
+#include "hashtable.h"
+#include "pmap.h"
+#include "future.h"
+#include "actor.h"
+#include "task.h"
+#include "record.h"
+#include "bytevector.h"
 
 
 
 // Helper function to print appropriate evaluation error message and cleanup
 // memory on exit
 void evaluationError(int error) {
-    printf("Evaluation error: ");
+    fprintf(outputFile, "Evaluation error: ");
     if (error == 0) {
-        printf("Test condition for if statement doesn't resolve solve to a boolean\n");
+        fprintf(outputFile, "Test condition for if statement doesn't resolve solve to a boolean\n");
     }
     else if (error == 1) {
-        printf("If statement doesn't contain enough arguments\n");
+        fprintf(outputFile, "If statement doesn't contain enough arguments\n");
     }
     else if (error == 2) {
-        printf("Parameter for Let must be nested list\n");
+        fprintf(outputFile, "Parameter for Let must be nested list\n");
     }
     else if (error == 3) {
-        printf("Symbol being evaluated doesn't have a bound value\n");
+        fprintf(outputFile, "Symbol being evaluated doesn't have a bound value\n");
     }
     else if (error == 4) {
-        printf("Not a recognized special form\n");
+        fprintf(outputFile, "Not a recognized special form\n");
     }
     else if (error == 5) {
-        printf("Not a symbol\n");
+        fprintf(outputFile, "Not a symbol\n");
     }
     else if (error == 6) {
-        printf("Too many arguments for define\n");
+        fprintf(outputFile, "Too many arguments for define\n");
     }
     else if (error == 7) {
-        printf("Lambda needs multiple parameters\n");
+        fprintf(outputFile, "Lambda needs multiple parameters\n");
     }
     else if (error == 8) {
-        printf("Function call has too many parameters\n");
+        fprintf(outputFile, "Function call has too many parameters\n");
     }
     else if (error == 9) {
-        printf("Function call needs more parameters\n");
+        fprintf(outputFile, "Function call needs more parameters\n");
     }
     else if (error == 10) {
-        printf("Invalid arguments for primitive function\n");
+        fprintf(outputFile, "Invalid arguments for primitive function\n");
     }
     else if (error == 11) {
-        printf("Car and Cdr require a list as an argument\n");
+        fprintf(outputFile, "Car and Cdr require a list as an argument\n");
     }
     else if (error == 12) {
-        printf("Invalid arguments for let statement\n");
+        fprintf(outputFile, "Invalid arguments for let statement\n");
     }
     else if (error == 13) {
-        printf("Invalid input for COND, AND or OR, boolean expressions required\n");
+        fprintf(outputFile, "Invalid input for COND, AND or OR, boolean expressions required\n");
     }
     else if (error == 14) {
-        printf("Invalid symbol for COND statement\n");
+        fprintf(outputFile, "Invalid symbol for COND statement\n");
     }
     else if (error == 15) {
-        printf("Multiplication requires at least two arguments\n");
+        fprintf(outputFile, "Multiplication requires at least two arguments\n");
+    }
+    else if (error == 16) {
+        fprintf(outputFile, "Maximum recursion depth exceeded\n");
+    }
+    else if (error == 17) {
+        fprintf(outputFile, "Every task is waiting on a channel\n");
+    }
+    else if (error == 18) {
+        fprintf(outputFile, "Invalid define-record-type form\n");
+    }
+    else if (error == 19) {
+        fprintf(outputFile, "File could not be opened\n");
     }
     texit(1);
 }
@@ -93,7 +117,7 @@ void printVal(Value *input) {
             printf("%f:float", input->d);
             break;
         case STR_TYPE:
-            printf("\"%s\":string", input->s);
+            printf("\"%.*s\":string", (int) input->str.length, input->str.chars);
             break;
         case SYMBOL_TYPE:
             printf("%s:symbol", input->s);
@@ -123,40 +147,24 @@ Value *falseVal() {
     return false_val;
 }
 
-Value *evalEach(Value *args, Frame *frame) {
-    // Evaluates every argument, and returns the list
-    Value *cur_node = args;
-    Value *evaled_args = makeNull();
-    
-    while (cur_node->type != NULL_TYPE) {
-        Value *arg = car(cur_node);
-        Value *evaled_arg = eval(arg, frame);
-        
-        evaled_args = cons(evaled_arg, evaled_args);
-        cur_node = cdr(cur_node);
-    }
-    // Reverse list after cons created the evaluated list in reverse
-    evaled_args = reverse(evaled_args);
-    
-    return evaled_args;
-}
+// Primitives are called with their arguments in an array, argv, of argc
+// Values. apply() has already checked argc against the arity in the
+// primitives table, so each primitive only checks the types of its arguments.
 
-Value *primitiveAdd(Value *args) {
-    // Sets initial result value and add each succesive value in args list
+Value *primitiveAdd(int argc, Value **argv) {
+    // Sets initial result value and add each succesive value in argv
     float result = 0;
-    while (args->type != NULL_TYPE) {
-        Value *cur_node = car(args);
+    for (int i = 0; i < argc; i++) {
+        Value *cur_node = argv[i];
         if (cur_node->type != INT_TYPE) {
             if (cur_node->type != DOUBLE_TYPE) {
                 // Throws error if the argument isn't a number
                 evaluationError(10);
             }
             result = result + cur_node->d;
-            args = cdr(args);
         }
         else {
             result = result + cur_node->i;
-            args = cdr(args);
         }
     }
     Value *result_val = talloc(sizeof(Value));
@@ -165,32 +173,27 @@ Value *primitiveAdd(Value *args) {
     return result_val;
 }
 
-Value *primitiveMultiply(Value *args) {
-    // Variables used to determine return value, and error status
+Value *primitiveMultiply(int argc, Value **argv) {
+    // Variable used to determine return value
     float result = 1;
-    int number_of_args = 0;
-    while (args->type != NULL_TYPE) {
-        Value *cur_node = car(args);
+    for (int i = 0; i < argc; i++) {
+        Value *cur_node = argv[i];
         // Checks for int or double type
         if (cur_node->type != INT_TYPE) {
             // Throws an error if the argument isn't a number
             if (cur_node->type != DOUBLE_TYPE) {
                 evaluationError(10);
             }
-            // Increments args, updates result
-            number_of_args++;
             result = result * cur_node->d;
-            args = cdr(args);
         }
         else {
-            // Increments args, updates result
-            number_of_args++;
             result = result * cur_node->i;
-            args = cdr(args);
         }
     }
-    // Throws an error if there are less than 2 arguments
-    if (number_of_args < 2) {
+    // Throws an error if there are less than 2 arguments. This is checked
+    // here rather than through the arity table so that it is reported after
+    // any bad argument, and with its own message.
+    if (argc < 2) {
         evaluationError(15);
     }
     Value *result_val = talloc(sizeof(Value));
@@ -200,17 +203,8 @@ Value *primitiveMultiply(Value *args) {
 }
 
 
-Value *primitiveNull(Value *args) {
-    // The argument passed should not be empty
-    if (args->type == NULL_TYPE) {
-        evaluationError(10);
-    }
-    assert(args->type == CONS_TYPE);
-    // If the cdr isn't empty, then they have passed more than one argument
-    if (cdr(args)->type != NULL_TYPE) {
-        evaluationError(10);
-    }
-    if (car(args)->type == NULL_TYPE) {
+Value *primitiveNull(int argc, Value **argv) {
+    if (argv[0]->type == NULL_TYPE) {
         // Calls method that returns true bool val
         return trueVal();
     }
@@ -220,32 +214,17 @@ Value *primitiveNull(Value *args) {
     }
 }
 
-Value *primitiveCar(Value *args) {
-    // Cannot call car of a nonexistent argument
-    if (args->type == NULL_TYPE){
-        evaluationError(10);
-    }
-    assert(args->type == CONS_TYPE);
-    // Cannot have more than one argument
-    if (cdr(args)->type != NULL_TYPE) {
-        evaluationError(10);
-    }
+Value *primitiveCar(int argc, Value **argv) {
     // takes the first argument, and returns its car
-    Value *argument = car(args);
+    Value *argument = argv[0];
+    if (argument->type != CONS_TYPE) {
+        evaluationError(11);
+    }
     return car(argument);
 }
 
-Value *primitiveCdr(Value *args) {
-    // Cannot call car of a nonexistent argument
-    if (args->type == NULL_TYPE){
-        evaluationError(10);
-    }
-    assert(args->type == CONS_TYPE);
-    // Cannot have more than one argument
-    if (cdr(args)->type != NULL_TYPE) {
-        evaluationError(10);
-    }
-    Value *lst = car(args);
+Value *primitiveCdr(int argc, Value **argv) {
+    Value *lst = argv[0];
     if (lst->type != CONS_TYPE) {
         evaluationError(11);
     }
@@ -253,85 +232,147 @@ Value *primitiveCdr(Value *args) {
     return cdr(lst);
 }
 
-Value *primitiveCons(Value *args) {
-    // Must have two arguments
-    if (args->type == NULL_TYPE) {
-        evaluationError(10);
-    }
-    if (car(args)->type == NULL_TYPE) {
+Value *primitiveCons(int argc, Value **argv) {
+    // The empty list can't be put at the front of a cons cell
+    if (argv[0]->type == NULL_TYPE) {
         evaluationError(10);
     }
-    if (cdr(args)->type == NULL_TYPE) {
-        evaluationError(10);
+    Value *result_val = cons(argv[0], argv[1]);
+    return result_val;
+}
+
+// Converts a numeric argument to a float for comparison, or raises an error
+// if the argument isn't a number
+float numberArg(Value *argument) {
+    if (argument->type == INT_TYPE) {
+        return (float) argument->i;
     }
-    
-    // If there exists a third argument, throw an Error
-    if (cdr(args)->type == CONS_TYPE && cdr(cdr(args))->type != NULL_TYPE) {
-        evaluationError(10);
+    else if (argument->type == DOUBLE_TYPE) {
+        return argument->d;
     }
-    //The first argument to put in cons cell will always be car(args)
-    Value *arg1 = car(args);
-    Value *arg2;
-    
+    evaluationError(10);
+    return 0;
+}
+
+Value *primitiveEquals(int argc, Value **argv) {
+    // Create float versions of two args for comparison
+    float arg1 = numberArg(argv[0]);
+    float arg2 = numberArg(argv[1]);
     
-    if (cdr(args)->type == CONS_TYPE) {
-        arg2 = car(cdr(args));
+    // Perform comparison and return corresponding boolean
+    if (arg1 == arg2) {
+        return trueVal();
     }
-    // If the cdr of args isn't a Cons type, we simply set arg2 as the cdr
     else {
-        arg2 = cdr(args);
+        return falseVal();
     }
-    Value *result_val = cons(arg1, arg2);
-    return result_val;
 }
 
-Value *primitiveEquals(Value *args) {
-    // Must have two arguments
-    if (args->type == NULL_TYPE) {
-        evaluationError(10);
+Value *primitiveGreaterThan(int argc, Value **argv) {
+    // Create float versions of two args for comparison
+    float arg1 = numberArg(argv[0]);
+    float arg2 = numberArg(argv[1]);
+    
+    // Perform comparison and return corresponding boolean
+    if (arg1 > arg2) {
+        return trueVal();
     }
-    if (car(args)->type == NULL_TYPE) {
-        evaluationError(10);
+    else {
+        return falseVal();
     }
-    if (cdr(args)->type == NULL_TYPE) {
-        evaluationError(10);
+}
+
+Value *primitiveLessThan(int argc, Value **argv) {
+    // Create float versions of two args for comparison
+    float arg1 = numberArg(argv[0]);
+    float arg2 = numberArg(argv[1]);
+    
+    // Perform comparison and return corresponding boolean
+    if (arg1 < arg2) {
+        return trueVal();
     }
-    // If there exists a third argument, throw an Error
-    if (cdr(args)->type == CONS_TYPE && cdr(cdr(args))->type != NULL_TYPE) {
-        evaluationError(10);
+    else {
+        return falseVal();
     }
-    
-    // Create float versions of two args for comparison
+}
+
+Value *primitiveDivide(int argc, Value **argv) {
+    // Create int and float versions for each argument
     float arg1;
+    int arg_1 = NULL;
+    
     float arg2;
+    int arg_2 = NULL;
     
-    // Assign an int or double to float for comparison
-    if (car(args)->type == INT_TYPE) {
-        Value *argument = car(args);
+    // Assign based on type
+    if (argv[0]->type == INT_TYPE) {
+        Value *argument = argv[0];
         arg1 = (float) argument->i;
+        arg_1 = argument->i; 
     }
-    else if (car(args)->type == DOUBLE_TYPE) {
-        Value *argument = car(args);
+    else if (argv[0]->type == DOUBLE_TYPE) {
+        Value *argument = argv[0];
         arg1 = argument->d;
     }
     else {
         evaluationError(10);
     }
     
-    if (car(cdr(args))->type == INT_TYPE) {
-        Value *argument1 = car(cdr(args));
+    if (argv[1]->type == INT_TYPE) {
+        Value *argument1 = argv[1];
         arg2 = (float) argument1->i;
+        arg_2 = argument1->i;
     }
-    else if (car(cdr(args))->type == DOUBLE_TYPE) {
-        Value *argument1 = car(cdr(args));
+    else if (argv[1]->type == DOUBLE_TYPE) {
+        Value *argument1 = argv[1];
         arg2 = argument1->d;
     }
     else {
         evaluationError(10);
     }
     
-    // Perform comparison and return corresponding boolean
-    if (arg1 == arg2) {
+    // Determine whether to perform integer or real division
+    if (arg_1 != NULL && arg_2 != NULL) {
+        // Integer division
+        int result = arg_1/arg_2;
+        
+        Value *result_val = talloc(sizeof(Value));
+        result_val->type = INT_TYPE;
+        result_val->i = result;
+    
+        return result_val;
+    }
+    
+    // Else, real division
+    float result = arg1/arg2;
+    
+    Value *result_val = talloc(sizeof(Value));
+    result_val->type = DOUBLE_TYPE;
+    result_val->d = result;
+    
+    return result_val;
+}
+
+Value *primitiveModulo(int argc, Value **argv) {
+    // Check type of arguments
+    if (argv[0]->type != INT_TYPE || argv[1]->type != INT_TYPE) {
+        evaluationError(10);
+    }
+    
+    // Perform modular arithmetic and return result
+    int result = argv[0]->i % argv[1]->i;
+
+    Value *result_val = talloc(sizeof(Value));
+    result_val->type = INT_TYPE;
+    result_val->i = result;
+
+    return result_val;
+}
+
+Value *primitiveGreaterOrEqual(int argc, Value **argv) {
+    // Returns the opposite boolean value of the opposite arithmetic function
+    Value *bool_val = primitiveLessThan(argc, argv);
+    if (bool_val->i == 0) {
         return trueVal();
     }
     else {
@@ -339,334 +380,1477 @@ Value *primitiveEquals(Value *args) {
     }
 }
 
-Value *primitiveGreaterThan(Value *args) {
-    // Must have two arguments
-    if (args->type == NULL_TYPE) {
+Value *primitiveLessOrEqual(int argc, Value **argv) {
+    // Returns the opposite boolean value of the opposite arithmetic function
+    Value *bool_val = primitiveGreaterThan(argc, argv);
+    if (bool_val->i == 0) {
+        return trueVal();
+    }
+    else {
+        return falseVal();
+    }
+}
+
+Value *primitiveSubtract(int argc, Value **argv) {
+    // Create result to return
+    float result = 0;
+    
+    // Add first argument to result
+    Value *cur_node = argv[0];
+    if (cur_node->type != INT_TYPE) {
+        if (cur_node->type != DOUBLE_TYPE) {
+            evaluationError(10);
+        }
+        result = result + cur_node->d;
+    }
+    else {
+        result = result + cur_node->i;
+    }
+    
+    // And subtract subsequent arguments
+    for (int i = 1; i < argc; i++) {
+        Value *cur_node = argv[i];
+        if (cur_node->type != INT_TYPE) {
+            if (cur_node->type != DOUBLE_TYPE) {
+                evaluationError(10);
+            }
+            result = result - cur_node->d;
+        }
+        else {
+            result = result - cur_node->i;
+        }
+    }
+    // Return value of result
+    Value *result_val = talloc(sizeof(Value));
+    result_val->type = DOUBLE_TYPE;
+    result_val->d = result;
+    return result_val;
+}
+
+// Checks whether a Value can be applied to arguments
+int isProcedure(Value *value) {
+    return value->type == CLOSURE_TYPE || value->type == PRIMITIVE_TYPE ||
+           value->type == MEMOIZED_TYPE || value->type == RECORD_PROC_TYPE;
+}
+
+// Wraps a procedure in a memoized procedure with an empty table
+Value *makeMemoized(Value *function) {
+    if (!isProcedure(function)) {
         evaluationError(10);
     }
-    if (car(args)->type == NULL_TYPE) {
+    struct Memo *memo = talloc(sizeof(struct Memo));
+    memo->function = function;
+    memo->table = makeHashTable(HASH_EQUAL);
+    memo->hits = 0;
+    memo->misses = 0;
+    Value *memoized = talloc(sizeof(Value));
+    memoized->type = MEMOIZED_TYPE;
+    memoized->memo = memo;
+    return memoized;
+}
+
+Value *primitiveMemoize(int argc, Value **argv) {
+    return makeMemoized(argv[0]);
+}
+
+// Makes an integer Value
+Value *makeInt(int i) {
+    Value *int_val = talloc(sizeof(Value));
+    int_val->type = INT_TYPE;
+    int_val->i = i;
+    return int_val;
+}
+
+Value *primitiveMemoStats(int argc, Value **argv) {
+    // Returns the list (hits misses entries) for a memoized procedure
+    if (argv[0]->type != MEMOIZED_TYPE) {
         evaluationError(10);
     }
-    if (cdr(args)->type == NULL_TYPE) {
+    struct Memo *memo = argv[0]->memo;
+    Value *stats = makeNull();
+    stats = cons(makeInt(memo->table->count), stats);
+    stats = cons(makeInt(memo->misses), stats);
+    stats = cons(makeInt(memo->hits), stats);
+    return stats;
+}
+
+// Makes a void Value, returned by procedures called only for their effects
+Value *voidVal() {
+    Value *void_val = talloc(sizeof(Value));
+    void_val->type = VOID_TYPE;
+    return void_val;
+}
+
+Value *primitiveMakeHashTable(int argc, Value **argv) {
+    // Keys are compared with equal? unless the argument is the symbol eq
+    hashMode mode = HASH_EQUAL;
+    if (argc == 1) {
+        if (argv[0]->type != SYMBOL_TYPE) {
+            evaluationError(10);
+        }
+        if (strcmp(argv[0]->s, "eq") == 0) {
+            mode = HASH_EQ;
+        }
+        else if (strcmp(argv[0]->s, "equal") != 0) {
+            evaluationError(10);
+        }
+    }
+    Value *table = talloc(sizeof(Value));
+    table->type = HASH_TYPE;
+    table->table = makeHashTable(mode);
+    return table;
+}
+
+// Returns the table a hash table primitive was called on, or raises an error
+// if the first argument isn't one
+HashTable *tableArg(Value **argv) {
+    if (argv[0]->type != HASH_TYPE) {
         evaluationError(10);
     }
-    // If there exists a third argument, throw an Error
-    if (cdr(args)->type == CONS_TYPE && cdr(cdr(args))->type != NULL_TYPE) {
+    return argv[0]->table;
+}
+
+Value *primitiveHashRef(int argc, Value **argv) {
+    // Returns the default, or #f without one, when the key isn't there
+    Value *value = hashGet(tableArg(argv), argv[1]);
+    if (value != NULL) {
+        return value;
+    }
+    if (argc == 3) {
+        return argv[2];
+    }
+    return falseVal();
+}
+
+Value *primitiveHashSet(int argc, Value **argv) {
+    hashPut(tableArg(argv), argv[1], argv[2]);
+    return voidVal();
+}
+
+Value *primitiveHashRemove(int argc, Value **argv) {
+    hashRemove(tableArg(argv), argv[1]);
+    return voidVal();
+}
+
+Value *primitiveHashCount(int argc, Value **argv) {
+    return makeInt(tableArg(argv)->count);
+}
+
+Value *primitiveHashKeys(int argc, Value **argv) {
+    // Returns a list of the keys, in no particular order
+    HashTable *table = tableArg(argv);
+    Value *keys = makeNull();
+    unsigned long position = 0;
+    hashLock(table);
+    for (HashEntry *entry = hashNext(table, &position); entry != NULL;
+         entry = hashNext(table, &position)) {
+        keys = cons(entry->key, keys);
+    }
+    hashUnlock(table);
+    return keys;
+}
+
+Value *primitiveHashToList(int argc, Value **argv) {
+    // Returns a list of (key . value) pairs, in no particular order
+    HashTable *table = tableArg(argv);
+    Value *pairs = makeNull();
+    unsigned long position = 0;
+    hashLock(table);
+    for (HashEntry *entry = hashNext(table, &position); entry != NULL;
+         entry = hashNext(table, &position)) {
+        pairs = cons(cons(entry->key, entry->value), pairs);
+    }
+    hashUnlock(table);
+    return pairs;
+}
+
+// Makes a Value for a persistent map
+Value *makePmapVal(Pmap *map) {
+    Value *pmap_val = talloc(sizeof(Value));
+    pmap_val->type = PMAP_TYPE;
+    pmap_val->pmap = map;
+    return pmap_val;
+}
+
+Value *primitivePmap(int argc, Value **argv) {
+    // Returns a map of the alternating keys and values given
+    if (argc % 2 != 0) {
         evaluationError(10);
     }
-    
-    // Create float versions of two args for comparison
-    float arg1;
-    float arg2;
-    
-    // Assign an int or double to float for comparison
-    if (car(args)->type == INT_TYPE) {
-        Value *argument = car(args);
-        arg1 = (float) argument->i;
+    Pmap *map = pmapEmpty();
+    for (int i = 0; i < argc; i += 2) {
+        map = pmapAssoc(map, argv[i], argv[i + 1]);
     }
-    else if (car(args)->type == DOUBLE_TYPE) {
-        Value *argument = car(args);
-        arg1 = argument->d;
+    return makePmapVal(map);
+}
+
+// Returns the map a persistent map primitive was called on, or raises an
+// error if the first argument isn't one
+Pmap *pmapArg(Value **argv) {
+    if (argv[0]->type != PMAP_TYPE) {
+        evaluationError(10);
     }
-    else {
+    return argv[0]->pmap;
+}
+
+Value *primitivePmapGet(int argc, Value **argv) {
+    // Returns the default, or #f without one, when the key isn't there
+    Value *value = pmapGet(pmapArg(argv), argv[1]);
+    if (value != NULL) {
+        return value;
+    }
+    if (argc == 3) {
+        return argv[2];
+    }
+    return falseVal();
+}
+
+Value *primitivePmapAssoc(int argc, Value **argv) {
+    return makePmapVal(pmapAssoc(pmapArg(argv), argv[1], argv[2]));
+}
+
+Value *primitivePmapDissoc(int argc, Value **argv) {
+    return makePmapVal(pmapDissoc(pmapArg(argv), argv[1]));
+}
+
+Value *primitivePmapCount(int argc, Value **argv) {
+    return makeInt(pmapArg(argv)->count);
+}
+
+// Adds a (key . value) pair to the list data points to
+void collectPair(Value *key, Value *value, void *data) {
+    Value **pairs = data;
+    *pairs = cons(cons(key, value), *pairs);
+}
+
+Value *primitivePmapToList(int argc, Value **argv) {
+    // Returns a list of (key . value) pairs, in no particular order
+    Value *pairs = makeNull();
+    pmapEach(pmapArg(argv), collectPair, &pairs);
+    return pairs;
+}
+
+Value *primitiveFuture(int argc, Value **argv) {
+    // The thunk is checked for being a procedure here, and for taking no
+    // arguments when it is run
+    if (!isProcedure(argv[0])) {
         evaluationError(10);
     }
-    
-    if (car(cdr(args))->type == INT_TYPE) {
-        Value *argument1 = car(cdr(args));
-        arg2 = (float) argument1->i;
+    Value *future = talloc(sizeof(Value));
+    future->type = FUTURE_TYPE;
+    future->future = makeFuture(argv[0]);
+    return future;
+}
+
+Value *primitiveTouch(int argc, Value **argv) {
+    if (argv[0]->type != FUTURE_TYPE) {
+        evaluationError(10);
     }
-    else if (car(cdr(args))->type == DOUBLE_TYPE) {
-        Value *argument1 = car(cdr(args));
-        arg2 = argument1->d;
+    return touchFuture(argv[0]->future);
+}
+
+// par-map, par-for-each and par-reduce split their list into chunks, each
+// handled by a future, once it has at least PAR_MIN_LENGTH elements and there
+// is more than one thread to run on. There are PAR_CHUNKS_PER_THREAD chunks
+// per thread, so that threads finishing early can steal from slower ones, but
+// none shorter than PAR_MIN_CHUNK, so the cost of a future is spread over
+// enough calls.
+#define PAR_MIN_LENGTH 64
+#define PAR_CHUNKS_PER_THREAD 4
+#define PAR_MIN_CHUNK 16
+
+// One chunk of a parallel operation: function applied to items[start] up to
+// items[end - 1]
+typedef struct ParChunk {
+    Value *function;
+    Value **items;
+    int start;
+    int end;
+    Value **results;
+} ParChunk;
+
+// Checks the procedure and list arguments of a parallel primitive, and
+// returns the list's elements as an array, setting length
+Value **parItems(Value *function, Value *list, int *length) {
+    if (!isProcedure(function)) {
+        evaluationError(10);
+    }
+    int count = 0;
+    for (Value *rest = list; rest->type != NULL_TYPE; rest = rest->c.cdr) {
+        if (rest->type != CONS_TYPE) {
+            evaluationError(10);
+        }
+        count++;
+    }
+    Value **items = talloc((count + 1) * sizeof(Value *));
+    count = 0;
+    for (Value *rest = list; rest->type != NULL_TYPE; rest = rest->c.cdr) {
+        items[count++] = rest->c.car;
+    }
+    *length = count;
+    return items;
+}
+
+// Returns how many chunks to split length items into, or 1 to do the whole
+// operation on the calling thread
+int parChunkCount(int length) {
+    if (length < PAR_MIN_LENGTH) {
+        return 1;
+    }
+    int threads = futurePoolSize();
+    int chunks = threads * PAR_CHUNKS_PER_THREAD;
+    if (chunks > length / PAR_MIN_CHUNK) {
+        chunks = length / PAR_MIN_CHUNK;
+    }
+    return threads > 1 && chunks > 1 ? chunks : 1;
+}
+
+// Applies the function to each item of a chunk, keeping the results if the
+// chunk has somewhere to put them
+Value *parMapChunk(void *data) {
+    ParChunk *chunk = data;
+    for (int i = chunk->start; i < chunk->end; i++) {
+        Value *result = apply(chunk->function, 1, &chunk->items[i]);
+        if (chunk->results != NULL) {
+            chunk->results[i] = result;
+        }
+    }
+    return NULL;
+}
+
+// Folds the function over the items of a chunk from the left, starting from
+// the first item
+Value *parReduceChunk(void *data) {
+    ParChunk *chunk = data;
+    Value *argv[2];
+    argv[0] = chunk->items[chunk->start];
+    for (int i = chunk->start + 1; i < chunk->end; i++) {
+        argv[1] = chunk->items[i];
+        argv[0] = apply(chunk->function, 2, argv);
+    }
+    return argv[0];
+}
+
+// Runs task on chunks of the items, in parallel, and returns the chunks' results
+// in order
+Value **parRun(Value *(*task)(void *data), Value *function, Value **items,
+               int length, Value **results, int chunks) {
+    ParChunk *chunk = talloc(chunks * sizeof(ParChunk));
+    struct Future **futures = talloc(chunks * sizeof(struct Future *));
+    for (int i = 0; i < chunks; i++) {
+        chunk[i].function = function;
+        chunk[i].items = items;
+        chunk[i].start = (long) length * i / chunks;
+        chunk[i].end = (long) length * (i + 1) / chunks;
+        chunk[i].results = results;
+        futures[i] = makeTask(task, &chunk[i]);
+    }
+    Value **chunk_results = talloc(chunks * sizeof(Value *));
+    for (int i = 0; i < chunks; i++) {
+        chunk_results[i] = touchFuture(futures[i]);
+    }
+    return chunk_results;
+}
+
+Value *primitiveParMap(int argc, Value **argv) {
+    // Like map, with the calls spread over the future threads. The results
+    // are in the order of the list; the calls may happen in any order.
+    int length;
+    Value **items = parItems(argv[0], argv[1], &length);
+    Value **results = talloc((length + 1) * sizeof(Value *));
+    ParChunk whole = {argv[0], items, 0, length, results};
+    int chunks = parChunkCount(length);
+    if (chunks == 1) {
+        parMapChunk(&whole);
     }
     else {
-        evaluationError(10);
+        parRun(parMapChunk, argv[0], items, length, results, chunks);
     }
-    
-    // Perform comparison and return corresponding boolean
-    if (arg1 > arg2) {
-        return trueVal();
+    Value *list = makeNull();
+    for (int i = length - 1; i >= 0; i--) {
+        list = cons(results[i], list);
+    }
+    return list;
+}
+
+Value *primitiveParForEach(int argc, Value **argv) {
+    // Like for-each, but the calls may happen in any order
+    int length;
+    Value **items = parItems(argv[0], argv[1], &length);
+    ParChunk whole = {argv[0], items, 0, length, NULL};
+    int chunks = parChunkCount(length);
+    if (chunks == 1) {
+        parMapChunk(&whole);
     }
     else {
-        return falseVal();
+        parRun(parMapChunk, argv[0], items, length, NULL, chunks);
     }
+    return voidVal();
 }
 
-Value *primitiveLessThan(Value *args) {
-    // Must have two arguments
-    if (args->type == NULL_TYPE) {
+Value *primitiveParReduce(int argc, Value **argv) {
+    // (par-reduce f init list) is (f (f (f init x1) x2) x3) and so on, with
+    // runs of the list folded in parallel and then combined, so f must be
+    // associative
+    int length;
+    Value **items = parItems(argv[0], argv[2], &length);
+    Value *combine[2];
+    combine[0] = argv[1];
+    int chunks = parChunkCount(length);
+    if (chunks == 1) {
+        for (int i = 0; i < length; i++) {
+            combine[1] = items[i];
+            combine[0] = apply(argv[0], 2, combine);
+        }
+        return combine[0];
+    }
+    Value **chunk_results = parRun(parReduceChunk, argv[0], items, length,
+                                   NULL, chunks);
+    for (int i = 0; i < chunks; i++) {
+        combine[1] = chunk_results[i];
+        combine[0] = apply(argv[0], 2, combine);
+    }
+    return combine[0];
+}
+
+// Returns the actor a primitive was called on, or raises an error if the
+// first argument isn't one
+struct Actor *actorArg(Value **argv) {
+    if (argv[0]->type != ACTOR_TYPE) {
         evaluationError(10);
     }
-    if (car(args)->type == NULL_TYPE) {
+    return argv[0]->actor;
+}
+
+// Makes an actor Value
+Value *makeActorVal(struct Actor *actor) {
+    Value *actor_val = talloc(sizeof(Value));
+    actor_val->type = ACTOR_TYPE;
+    actor_val->actor = actor;
+    return actor_val;
+}
+
+Value *primitiveSpawn(int argc, Value **argv) {
+    // (spawn proc arg ...) calls proc on the args in an actor of its own;
+    // both are copied, so anything that can't be, such as a future, is an
+    // error here
+    if (!isProcedure(argv[0])) {
         evaluationError(10);
     }
-    if (cdr(args)->type == NULL_TYPE) {
+    Value *args = makeNull();
+    for (int i = argc - 1; i > 0; i--) {
+        args = cons(argv[i], args);
+    }
+    struct Actor *actor = spawnActor(argv[0], args);
+    if (actor == NULL) {
         evaluationError(10);
     }
-    // If there exists a third argument, throw an Error
-    if (cdr(args)->type == CONS_TYPE && cdr(cdr(args))->type != NULL_TYPE) {
+    return makeActorVal(actor);
+}
+
+Value *primitiveSend(int argc, Value **argv) {
+    // Sends a copy of the message, waiting only if the mailbox is full
+    if (!sendMessage(actorArg(argv), argv[1])) {
         evaluationError(10);
     }
-    
-    // Create float versions of two args for comparison
-    float arg1;
-    float arg2;
-    
-    // Assign an int or double to float for comparison
-    if (car(args)->type == INT_TYPE) {
-        Value *argument = car(args);
-        arg1 = (float) argument->i;
+    return voidVal();
+}
+
+Value *primitiveReceive(int argc, Value **argv) {
+    // Returns the oldest message sent to this thread, waiting for one if
+    // there are none
+    return receiveMessage();
+}
+
+Value *primitiveSelf(int argc, Value **argv) {
+    return makeActorVal(selfActor());
+}
+
+Value *primitiveSpawnTask(int argc, Value **argv) {
+    // The thunk is checked for taking no arguments when the task starts
+    if (!isProcedure(argv[0])) {
+        evaluationError(10);
     }
-    else if (car(args)->type == DOUBLE_TYPE) {
-        Value *argument = car(args);
-        arg1 = argument->d;
+    spawnTask(argv[0]);
+    return voidVal();
+}
+
+Value *primitiveYield(int argc, Value **argv) {
+    yieldTask();
+    return voidVal();
+}
+
+Value *primitiveMakeChannel(int argc, Value **argv) {
+    // Without a capacity, every put waits for a get
+    int capacity = 0;
+    if (argc == 1) {
+        if (argv[0]->type == INT_TYPE) {
+            capacity = argv[0]->i;
+        }
+        else if (argv[0]->type == DOUBLE_TYPE) {
+            capacity = (int) argv[0]->d;
+        }
+        else {
+            evaluationError(10);
+        }
+        if (capacity < 0) {
+            evaluationError(10);
+        }
     }
-    else {
+    Value *channel = talloc(sizeof(Value));
+    channel->type = CHANNEL_TYPE;
+    channel->channel = makeChannel(capacity);
+    return channel;
+}
+
+// Returns the channel a channel primitive was called on, or raises an error
+// if the first argument isn't one
+struct Channel *channelArg(Value **argv) {
+    if (argv[0]->type != CHANNEL_TYPE) {
         evaluationError(10);
     }
-    
-    if (car(cdr(args))->type == INT_TYPE) {
-        Value *argument1 = car(cdr(args));
-        arg2 = (float) argument1->i;
+    return argv[0]->channel;
+}
+
+Value *primitiveChannelPut(int argc, Value **argv) {
+    channelPut(channelArg(argv), argv[1]);
+    return voidVal();
+}
+
+Value *primitiveChannelGet(int argc, Value **argv) {
+    return channelGet(channelArg(argv));
+}
+
+// Returns an argument that must be a whole number, such as an index, which
+// arithmetic may have made a double, or raises an error
+double integerArg(Value *argument) {
+    double value = 0;
+    if (argument->type == INT_TYPE) {
+        value = argument->i;
     }
-    else if (car(cdr(args))->type == DOUBLE_TYPE) {
-        Value *argument1 = car(cdr(args));
-        arg2 = argument1->d;
+    else if (argument->type == DOUBLE_TYPE &&
+             argument->d == (long) argument->d) {
+        value = argument->d;
     }
     else {
         evaluationError(10);
     }
-    
-    // Perform comparison and return corresponding boolean
-    if (arg1 < arg2) {
+    return value;
+}
+
+// Makes a string Value of length characters starting at chars, which are
+// shared rather than copied
+Value *makeString(char *chars, size_t length) {
+    Value *string = talloc(sizeof(Value));
+    string->type = STR_TYPE;
+    string->str.chars = chars;
+    string->str.length = length;
+    return string;
+}
+
+// Returns the characters of a string followed by a NUL, for C functions that
+// need one. The character after a string is always inside the buffer it
+// shares, so it can be checked for being a NUL already; a substring ending
+// before the end of its buffer is copied.
+char *cString(Value *string) {
+    if (string->str.chars[string->str.length] == '\0') {
+        return string->str.chars;
+    }
+    char *copy = talloc(string->str.length + 1);
+    memcpy(copy, string->str.chars, string->str.length);
+    copy[string->str.length] = '\0';
+    return copy;
+}
+
+// Checks that every argument of a string primitive is a string
+void checkStringArgs(int argc, Value **argv) {
+    for (int i = 0; i < argc; i++) {
+        if (argv[i]->type != STR_TYPE) {
+            evaluationError(10);
+        }
+    }
+}
+
+Value *primitiveStringLength(int argc, Value **argv) {
+    checkStringArgs(1, argv);
+    return makeInt((int) argv[0]->str.length);
+}
+
+// Takes the characters of argv[0] from the index in argv[1] up to but not
+// including the index in argv[2], or to the end without one, sharing them
+Value *primitiveSubstring(int argc, Value **argv) {
+    checkStringArgs(1, argv);
+    double length = argv[0]->str.length;
+    double start = integerArg(argv[1]);
+    double end = argc == 3 ? integerArg(argv[2]) : length;
+    if (start < 0 || start > end || end > length) {
+        evaluationError(10);
+    }
+    return makeString(argv[0]->str.chars + (size_t) start,
+                      (size_t) (end - start));
+}
+
+Value *primitiveStringRef(int argc, Value **argv) {
+    // There is no character type, so the character comes back as a string
+    // of length one
+    checkStringArgs(1, argv);
+    double index = integerArg(argv[1]);
+    if (index < 0 || index >= argv[0]->str.length) {
+        evaluationError(10);
+    }
+    return makeString(argv[0]->str.chars + (size_t) index, 1);
+}
+
+Value *primitiveStringAppend(int argc, Value **argv) {
+    checkStringArgs(argc, argv);
+    size_t length = 0;
+    for (int i = 0; i < argc; i++) {
+        length += argv[i]->str.length;
+    }
+    char *chars = talloc(length + 1);
+    size_t position = 0;
+    for (int i = 0; i < argc; i++) {
+        memcpy(chars + position, argv[i]->str.chars, argv[i]->str.length);
+        position += argv[i]->str.length;
+    }
+    chars[length] = '\0';
+    return makeString(chars, length);
+}
+
+// Compares two strings character by character, like strcmp
+int compareStrings(Value *a, Value *b) {
+    size_t shorter = a->str.length < b->str.length ? a->str.length :
+                                                     b->str.length;
+    int order = memcmp(a->str.chars, b->str.chars, shorter);
+    if (order != 0) {
+        return order;
+    }
+    return (a->str.length > b->str.length) - (a->str.length < b->str.length);
+}
+
+Value *primitiveStringEquals(int argc, Value **argv) {
+    checkStringArgs(2, argv);
+    // Different lengths can't be equal, which needs no look at the characters
+    if (argv[0]->str.length == argv[1]->str.length &&
+        compareStrings(argv[0], argv[1]) == 0) {
         return trueVal();
     }
-    else {
-        return falseVal();
+    return falseVal();
+}
+
+Value *primitiveStringLessThan(int argc, Value **argv) {
+    checkStringArgs(2, argv);
+    return compareStrings(argv[0], argv[1]) < 0 ? trueVal() : falseVal();
+}
+
+Value *primitiveStringToSymbol(int argc, Value **argv) {
+    checkStringArgs(1, argv);
+    Value *symbol = talloc(sizeof(Value));
+    symbol->type = SYMBOL_TYPE;
+    symbol->sym.name = cString(argv[0]);
+    symbol->sym.cell = NULL;
+    symbol->sym.version = SYMBOL_UNCACHED;
+    return symbol;
+}
+
+Value *primitiveSymbolToString(int argc, Value **argv) {
+    if (argv[0]->type != SYMBOL_TYPE) {
+        evaluationError(10);
     }
+    return makeString(argv[0]->s, strlen(argv[0]->s));
 }
 
-Value *primitiveDivide(Value *args) {
-    // Must have two arguments
-    if (args->type == NULL_TYPE) {
+Value *primitiveNumberToString(int argc, Value **argv) {
+    // Numbers are written as the interpreter prints them
+    char buffer[400];
+    int length;
+    if (argv[0]->type == INT_TYPE) {
+        length = snprintf(buffer, sizeof(buffer), "%i", argv[0]->i);
+    }
+    else if (argv[0]->type == DOUBLE_TYPE) {
+        length = snprintf(buffer, sizeof(buffer), "%f", argv[0]->d);
+    }
+    else {
         evaluationError(10);
+        return NULL;
     }
-    if (car(args)->type == NULL_TYPE) {
+    char *chars = talloc(length + 1);
+    memcpy(chars, buffer, length + 1);
+    return makeString(chars, length);
+}
+
+Value *primitiveMakeBytevector(int argc, Value **argv) {
+    double length = integerArg(argv[0]);
+    int fill = argc == 2 ? (int) integerArg(argv[1]) : 0;
+    if (length < 0 || fill < -128 || fill > 255) {
         evaluationError(10);
     }
-    if (cdr(args)->type == NULL_TYPE) {
+    Value *bytevector = makeBytevector((size_t) length);
+    memset(bytevector->bytevector->data, fill & 0xff, (size_t) length);
+    return bytevector;
+}
+
+// Returns the bytevector a bytevector primitive was called on, or raises an
+// error if the first argument isn't one
+struct Bytevector *bytevectorArg(Value **argv) {
+    if (argv[0]->type != BYTEVECTOR_TYPE) {
         evaluationError(10);
     }
-    // If there exists a third argument, throw an Error
-    if (cdr(args)->type == CONS_TYPE && cdr(cdr(args))->type != NULL_TYPE) {
+    return argv[0]->bytevector;
+}
+
+Value *primitiveBytevectorLength(int argc, Value **argv) {
+    return makeInt((int) bytevectorArg(argv)->length);
+}
+
+// Ways the bytes at an index can be read and written
+typedef enum {BYTES_UNSIGNED, BYTES_SIGNED, BYTES_FLOAT} bytesFormat;
+
+// Returns where the size bytes at the index in argv[1] start, checking that
+// they are all inside the bytevector in argv[0]
+unsigned char *bytesAt(Value **argv, int size) {
+    struct Bytevector *bytevector = bytevectorArg(argv);
+    double index = integerArg(argv[1]);
+    if (index < 0 || index + size > bytevector->length) {
         evaluationError(10);
     }
-    
-    // Create int and float versions for each argument
-    float arg1;
-    int arg_1 = NULL;
-    
-    float arg2;
-    int arg_2 = NULL;
-    
-    // Assign based on type
-    if (car(args)->type == INT_TYPE) {
-        Value *argument = car(args);
-        arg1 = (float) argument->i;
-        arg_1 = argument->i; 
+    return bytevector->data + (size_t) index;
+}
+
+// Checks whether the byte order argument, if there is one, is big, which
+// is the only other choice to little
+int bigEndianArg(int argc, Value **argv, int position) {
+    if (argc <= position) {
+        return 0;
     }
-    else if (car(args)->type == DOUBLE_TYPE) {
-        Value *argument = car(args);
-        arg1 = argument->d;
+    if (argv[position]->type != SYMBOL_TYPE) {
+        evaluationError(10);
     }
-    else {
+    if (strcmp(argv[position]->s, "big") == 0) {
+        return 1;
+    }
+    if (strcmp(argv[position]->s, "little") != 0) {
         evaluationError(10);
     }
-    
-    if (car(cdr(args))->type == INT_TYPE) {
-        Value *argument1 = car(cdr(args));
-        arg2 = (float) argument1->i;
-        arg_2 = argument1->i;
+    return 0;
+}
+
+// Reads the size bytes at an index as a number of the given format
+Value *bytevectorRef(int argc, Value **argv, int size, bytesFormat format) {
+    unsigned char *bytes = bytesAt(argv, size);
+    unsigned long bits = readBytes(bytes, size, bigEndianArg(argc, argv, 2));
+    Value *result = talloc(sizeof(Value));
+    if (format == BYTES_FLOAT) {
+        result->type = DOUBLE_TYPE;
+        if (size == sizeof(float)) {
+            unsigned int narrow = bits;
+            float f;
+            memcpy(&f, &narrow, sizeof(f));
+            result->d = f;
+        }
+        else {
+            memcpy(&result->d, &bits, sizeof(double));
+        }
+        return result;
     }
-    else if (car(cdr(args))->type == DOUBLE_TYPE) {
-        Value *argument1 = car(cdr(args));
-        arg2 = argument1->d;
+    long value = bits;
+    if (format == BYTES_SIGNED && (bits >> (size * 8 - 1)) != 0) {
+        value -= 1L << (size * 8);
+    }
+    // Unsigned 32 bit values too big for an int become doubles
+    if (value > 0x7fffffffL) {
+        result->type = DOUBLE_TYPE;
+        result->d = value;
     }
     else {
+        result->type = INT_TYPE;
+        result->i = (int) value;
+    }
+    return result;
+}
+
+// Writes a number to the size bytes at an index in the given format. Integers
+// must be whole and fit in size bytes.
+Value *bytevectorSet(int argc, Value **argv, int size, bytesFormat format) {
+    unsigned char *bytes = bytesAt(argv, size);
+    if (argv[0]->bytevector->readOnly) {
         evaluationError(10);
     }
-    
-    // Determine whether to perform integer or real division
-    if (arg_1 != NULL && arg_2 != NULL) {
-        // Integer division
-        int result = arg_1/arg_2;
-        
-        Value *result_val = talloc(sizeof(Value));
-        result_val->type = INT_TYPE;
-        result_val->i = result;
-    
-        return result_val;
+    unsigned long bits;
+    if (format == BYTES_FLOAT) {
+        double value = 0;
+        if (argv[2]->type == INT_TYPE) {
+            value = argv[2]->i;
+        }
+        else if (argv[2]->type == DOUBLE_TYPE) {
+            value = argv[2]->d;
+        }
+        else {
+            evaluationError(10);
+        }
+        if (size == sizeof(float)) {
+            float f = value;
+            unsigned int narrow;
+            memcpy(&narrow, &f, sizeof(narrow));
+            bits = narrow;
+        }
+        else {
+            memcpy(&bits, &value, sizeof(bits));
+        }
     }
-    
-    // Else, real division
-    float result = arg1/arg2;
-    
-    Value *result_val = talloc(sizeof(Value));
-    result_val->type = DOUBLE_TYPE;
-    result_val->d = result;
-    
-    return result_val;
+    else {
+        double value = integerArg(argv[2]);
+        double limit = (double) (1L << (size * 8));
+        double low = format == BYTES_SIGNED ? -limit / 2 : 0;
+        double high = format == BYTES_SIGNED ? limit / 2 : limit;
+        if (value < low || value >= high) {
+            evaluationError(10);
+        }
+        bits = (unsigned long) (long) value;
+    }
+    writeBytes(bytes, size, bigEndianArg(argc, argv, 3), bits);
+    return voidVal();
+}
+
+Value *primitiveBytevectorU8Ref(int argc, Value **argv) {
+    return bytevectorRef(argc, argv, 1, BYTES_UNSIGNED);
+}
+
+Value *primitiveBytevectorU8Set(int argc, Value **argv) {
+    return bytevectorSet(argc, argv, 1, BYTES_UNSIGNED);
+}
+
+Value *primitiveBytevectorS8Ref(int argc, Value **argv) {
+    return bytevectorRef(argc, argv, 1, BYTES_SIGNED);
+}
+
+Value *primitiveBytevectorS8Set(int argc, Value **argv) {
+    return bytevectorSet(argc, argv, 1, BYTES_SIGNED);
+}
+
+Value *primitiveBytevectorU16Ref(int argc, Value **argv) {
+    return bytevectorRef(argc, argv, 2, BYTES_UNSIGNED);
+}
+
+Value *primitiveBytevectorU16Set(int argc, Value **argv) {
+    return bytevectorSet(argc, argv, 2, BYTES_UNSIGNED);
+}
+
+Value *primitiveBytevectorS16Ref(int argc, Value **argv) {
+    return bytevectorRef(argc, argv, 2, BYTES_SIGNED);
+}
+
+Value *primitiveBytevectorS16Set(int argc, Value **argv) {
+    return bytevectorSet(argc, argv, 2, BYTES_SIGNED);
+}
+
+Value *primitiveBytevectorU32Ref(int argc, Value **argv) {
+    return bytevectorRef(argc, argv, 4, BYTES_UNSIGNED);
+}
+
+Value *primitiveBytevectorU32Set(int argc, Value **argv) {
+    return bytevectorSet(argc, argv, 4, BYTES_UNSIGNED);
+}
+
+Value *primitiveBytevectorS32Ref(int argc, Value **argv) {
+    return bytevectorRef(argc, argv, 4, BYTES_SIGNED);
+}
+
+Value *primitiveBytevectorS32Set(int argc, Value **argv) {
+    return bytevectorSet(argc, argv, 4, BYTES_SIGNED);
+}
+
+Value *primitiveBytevectorSingleRef(int argc, Value **argv) {
+    return bytevectorRef(argc, argv, 4, BYTES_FLOAT);
+}
+
+Value *primitiveBytevectorSingleSet(int argc, Value **argv) {
+    return bytevectorSet(argc, argv, 4, BYTES_FLOAT);
+}
+
+Value *primitiveBytevectorDoubleRef(int argc, Value **argv) {
+    return bytevectorRef(argc, argv, 8, BYTES_FLOAT);
+}
+
+Value *primitiveBytevectorDoubleSet(int argc, Value **argv) {
+    return bytevectorSet(argc, argv, 8, BYTES_FLOAT);
 }
 
-Value *primitiveModulo(Value *args) {
-    // Must take two arguments
-    if (args->type == NULL_TYPE) {
+Value *primitiveFileToBytevector(int argc, Value **argv) {
+    if (argv[0]->type != STR_TYPE) {
         evaluationError(10);
     }
-    if (car(args)->type == NULL_TYPE) {
-        evaluationError(10);
-    }
-    if (cdr(args)->type == NULL_TYPE) {
-        evaluationError(10);
+    Value *bytevector = mapFile(cString(argv[0]));
+    if (bytevector == NULL) {
+        evaluationError(19);
     }
-    // If third argument exists, throw an error
-    if (cdr(args)->type == CONS_TYPE && cdr(cdr(args))->type != NULL_TYPE) {
-        evaluationError(10);
+    return bytevector;
+}
+
+// Primitive functions bound in every global frame, with the fewest and most
+// arguments each accepts (-1 for no limit). The pure ones always give
+// the same result for the same arguments and have no side effects, so the
+// optimizer is free to call them ahead of time on constant arguments.
+Primitive primitives[] = {
+    {"+", primitiveAdd, 0, -1, 1},
+    {"-", primitiveSubtract, 1, -1, 1},
+    {"*", primitiveMultiply, 0, -1, 1},
+    {"/", primitiveDivide, 2, 2, 1},
+    {">", primitiveGreaterThan, 2, 2, 1},
+    {"<", primitiveLessThan, 2, 2, 1},
+    {">=", primitiveGreaterOrEqual, 2, 2, 1},
+    {"<=", primitiveLessOrEqual, 2, 2, 1},
+    {"=", primitiveEquals, 2, 2, 1},
+    {"modulo", primitiveModulo, 2, 2, 1},
+    {"null?", primitiveNull, 1, 1, 1},
+    {"car", primitiveCar, 1, 1, 1},
+    {"cdr", primitiveCdr, 1, 1, 1},
+    {"cons", primitiveCons, 2, 2, 0},
+    {"memoize", primitiveMemoize, 1, 1, 0},
+    {"memo-stats", primitiveMemoStats, 1, 1, 0},
+    {"make-hash-table", primitiveMakeHashTable, 0, 1, 0},
+    {"hash-ref", primitiveHashRef, 2, 3, 0},
+    {"hash-set!", primitiveHashSet, 3, 3, 0},
+    {"hash-remove!", primitiveHashRemove, 2, 2, 0},
+    {"hash-count", primitiveHashCount, 1, 1, 0},
+    {"hash-keys", primitiveHashKeys, 1, 1, 0},
+    {"hash->list", primitiveHashToList, 1, 1, 0},
+    {"pmap", primitivePmap, 0, -1, 0},
+    {"pmap-get", primitivePmapGet, 2, 3, 0},
+    {"pmap-assoc", primitivePmapAssoc, 3, 3, 0},
+    {"pmap-dissoc", primitivePmapDissoc, 2, 2, 0},
+    {"pmap-count", primitivePmapCount, 1, 1, 0},
+    {"pmap->list", primitivePmapToList, 1, 1, 0},
+    {"future", primitiveFuture, 1, 1, 0},
+    {"touch", primitiveTouch, 1, 1, 0},
+    {"par-map", primitiveParMap, 2, 2, 0},
+    {"par-for-each", primitiveParForEach, 2, 2, 0},
+    {"par-reduce", primitiveParReduce, 3, 3, 0},
+    {"spawn", primitiveSpawn, 1, -1, 0},
+    {"send", primitiveSend, 2, 2, 0},
+    {"receive", primitiveReceive, 0, 0, 0},
+    {"self", primitiveSelf, 0, 0, 0},
+    {"spawn-task", primitiveSpawnTask, 1, 1, 0},
+    {"yield", primitiveYield, 0, 0, 0},
+    {"make-channel", primitiveMakeChannel, 0, 1, 0},
+    {"channel-put!", primitiveChannelPut, 2, 2, 0},
+    {"channel-get", primitiveChannelGet, 1, 1, 0},
+    {"string-length", primitiveStringLength, 1, 1, 1},
+    {"string-ref", primitiveStringRef, 2, 2, 0},
+    {"substring", primitiveSubstring, 2, 3, 0},
+    {"string-append", primitiveStringAppend, 0, -1, 1},
+    {"string=?", primitiveStringEquals, 2, 2, 1},
+    {"string<?", primitiveStringLessThan, 2, 2, 1},
+    {"string->symbol", primitiveStringToSymbol, 1, 1, 1},
+    {"symbol->string", primitiveSymbolToString, 1, 1, 1},
+    {"number->string", primitiveNumberToString, 1, 1, 1},
+    {"make-bytevector", primitiveMakeBytevector, 1, 2, 0},
+    {"bytevector-length", primitiveBytevectorLength, 1, 1, 0},
+    {"bytevector-u8-ref", primitiveBytevectorU8Ref, 2, 2, 0},
+    {"bytevector-u8-set!", primitiveBytevectorU8Set, 3, 3, 0},
+    {"bytevector-s8-ref", primitiveBytevectorS8Ref, 2, 2, 0},
+    {"bytevector-s8-set!", primitiveBytevectorS8Set, 3, 3, 0},
+    {"bytevector-u16-ref", primitiveBytevectorU16Ref, 3, 3, 0},
+    {"bytevector-u16-set!", primitiveBytevectorU16Set, 4, 4, 0},
+    {"bytevector-s16-ref", primitiveBytevectorS16Ref, 3, 3, 0},
+    {"bytevector-s16-set!", primitiveBytevectorS16Set, 4, 4, 0},
+    {"bytevector-u32-ref", primitiveBytevectorU32Ref, 3, 3, 0},
+    {"bytevector-u32-set!", primitiveBytevectorU32Set, 4, 4, 0},
+    {"bytevector-s32-ref", primitiveBytevectorS32Ref, 3, 3, 0},
+    {"bytevector-s32-set!", primitiveBytevectorS32Set, 4, 4, 0},
+    {"bytevector-ieee-single-ref", primitiveBytevectorSingleRef, 3, 3, 0},
+    {"bytevector-ieee-single-set!", primitiveBytevectorSingleSet, 4, 4, 0},
+    {"bytevector-ieee-double-ref", primitiveBytevectorDoubleRef, 3, 3, 0},
+    {"bytevector-ieee-double-set!", primitiveBytevectorDoubleSet, 4, 4, 0},
+    {"file->bytevector", primitiveFileToBytevector, 1, 1, 0},
+    {NULL, NULL, 0, 0, 0}
+};
+
+// Returns the entry in primitives for the given name, or NULL if none
+Primitive *findPrimitive(char *name) {
+    for (int i = 0; primitives[i].name != NULL; i++) {
+        if (strcmp(primitives[i].name, name) == 0) {
+            return &primitives[i];
+        }
     }
+    return NULL;
+}
+
+void bind(Primitive *primitive, Frame *frame) {
+    // Add primitive functions to top-level bindings list
+    Value *fun_val = talloc(sizeof(Value));
+    fun_val->type = PRIMITIVE_TYPE;
+    fun_val->prim = primitive;
+    // Add binding of name to value
+    Value *symbol = talloc(sizeof(Value));
+    symbol->type = SYMBOL_TYPE;
+    symbol->s = primitive->name;
     
-    // Declare integer arguments for arithmetic operation
-    int arg1;
-    int arg2;
-    
-    // Check type of arguments
-    if (car(args)->type == INT_TYPE) {
-        if (car(cdr(args))->type == INT_TYPE) {
-            Value *argument = car(args);
-            arg1 = argument->i; 
-            Value *argument1 = car(cdr(args));
-            arg2 = argument1->i;
-            
-            // Perform modular arithmetic and return result
-            int result = arg1 % arg2;
-        
-            Value *result_val = talloc(sizeof(Value));
-            result_val->type = INT_TYPE;
-            result_val->i = result;
+    Value *binding = makeNull();
+    binding = cons(fun_val, binding);
+    binding = cons(symbol, binding);
     
-            return result_val;  
+    frame->bindings = cons(binding, frame->bindings);
+}
+
+// Global version counter for the inline caches on symbol references. A cached
+// binding is only used while the symbol's version matches this. It is bumped
+// whenever a new global frame is made and whenever define adds a global
+// binding, since that binding may shadow one already cached. set! doesn't need
+// to bump it: it updates the binding cell in place, so a cached cell still
+// holds the current value.
+unsigned long globalVersion = 1;
+
+// Checks whether a symbol with the given name is in a list of symbols
+int isBound(char *name, Value *bound) {
+    while (bound->type != NULL_TYPE) {
+        if (strcmp(car(bound)->s, name) == 0) {
+            return 1;
         }
-        else {
-            evaluationError(10);
+        bound = cdr(bound);
+    }
+    return 0;
+}
+
+// Adds the names of every define inside expr to bound, without looking inside
+// quoted data. Defines in nested scopes are included as well, which can only
+// make fewer references cacheable.
+Value *collectDefines(Value *expr, Value *bound) {
+    if (expr->type != CONS_TYPE) {
+        return bound;
+    }
+    Value *first = car(expr);
+    if (first->type == SYMBOL_TYPE) {
+        if (strcmp(first->s, "quote") == 0) {
+            return bound;
+        }
+        if ((strcmp(first->s, "define") == 0 ||
+             strcmp(first->s, "define-memoized") == 0) &&
+            cdr(expr)->type == CONS_TYPE && car(cdr(expr))->type == SYMBOL_TYPE) {
+            bound = cons(car(cdr(expr)), bound);
+        }
+        if (strcmp(first->s, "define-record-type") == 0) {
+            bound = recordTypeNames(cdr(expr), bound);
         }
     }
+    while (expr->type == CONS_TYPE) {
+        bound = collectDefines(car(expr), bound);
+        expr = cdr(expr);
+    }
+    return bound;
+}
 
-    else {
-        evaluationError(10);
+// Adds the variables named in a let style binding list to bound
+Value *collectLetNames(Value *bindings, Value *bound) {
+    while (bindings->type == CONS_TYPE) {
+        Value *binding = car(bindings);
+        if (binding->type == CONS_TYPE && car(binding)->type == SYMBOL_TYPE) {
+            bound = cons(car(binding), bound);
+        }
+        bindings = cdr(bindings);
     }
-    // Never reaches here
-    return falseVal();
+    return bound;
 }
 
-Value *primitiveGreaterOrEqual(Value *args) {
-    // Returns the opposite boolean value of the opposite arithmetic function
-    Value *bool_val = primitiveLessThan(args);
-    if (bool_val->i == 0) {
-        return trueVal();
+// Checks whether expr contains a lambda expression anywhere outside quoted
+// data. Any symbol named lambda counts, which is more than needed but safe.
+int containsLambda(Value *expr) {
+    if (expr->type == SYMBOL_TYPE) {
+        return strcmp(expr->s, "lambda") == 0;
     }
-    else {
-        return falseVal();
+    if (expr->type != CONS_TYPE) {
+        return 0;
+    }
+    if (car(expr)->type == SYMBOL_TYPE && strcmp(car(expr)->s, "quote") == 0) {
+        return 0;
+    }
+    while (expr->type == CONS_TYPE) {
+        if (containsLambda(car(expr))) {
+            return 1;
+        }
+        expr = cdr(expr);
     }
+    return 0;
 }
 
-Value *primitiveLessOrEqual(Value *args) {
-    // Returns the opposite boolean value of the opposite arithmetic function
-    Value *bool_val = primitiveGreaterThan(args);
-    if (bool_val->i == 0) {
-        return trueVal();
+// Makes the Lambda description for a lambda expression, given everything after
+// the lambda symbol. The frame of a call can only outlive the call if a closure
+// made during the call captures it, and only a lambda expression in the body
+// can make such a closure: frames of called procedures have their own closure's
+// frame as parent, and nested let frames die with this one.
+struct Lambda *describeLambda(Value *args) {
+    if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE) {
+        evaluationError(7);
     }
-    else {
-        return falseVal();
+    struct Lambda *lambda = talloc(sizeof(struct Lambda));
+    lambda->paramNames = car(args);
+    lambda->functionCode = car(cdr(args));
+    lambda->localFrame = !containsLambda(lambda->functionCode);
+    lambda->flat = 0;
+    lambda->freeNames = makeNull();
+    return lambda;
+}
+
+// A lambda expression resolveGlobals() is inside, with the list of variables
+// bound outside it. Since bound lists are only ever extended at the front, the
+// outer list of a lambda is a tail of the bound list anywhere in its body.
+typedef struct LambdaScope {
+    struct Lambda *lambda;
+    Value *outer;
+    struct LambdaScope *enclosing;
+} LambdaScope;
+
+__thread LambdaScope *lambdaScope = NULL;
+
+// Names given to variables with define anywhere below the top level of the
+// expression being resolved. Such a define can add a binding to a frame after
+// a closure has been made, shadowing the binding the closure would have
+// captured, so lambdas with one of these as a free variable are never flat.
+__thread Value *localDefines;
+
+// Checks whether cell is one of the cells of list
+int isTailCell(Value *cell, Value *list) {
+    while (list->type == CONS_TYPE) {
+        if (list == cell) {
+            return 1;
+        }
+        list = cdr(list);
     }
+    return 0;
 }
 
-Value *primitiveSubtract(Value *args) {
-    // Create result to return
-    float result = 0;
-    
-    // Add first argument to result
-    Value *cur_node = car(args);
-    if (cur_node->type != INT_TYPE) {
-        if (cur_node->type != DOUBLE_TYPE) {
-            evaluationError(10);
+// Records a reference to a local variable as a free variable of every
+// enclosing lambda that it is bound outside of
+void noteFreeReference(Value *symbol, Value *bound) {
+    // The innermost binding of the name is the first one in bound
+    Value *cell = bound;
+    while (strcmp(car(cell)->s, symbol->s) != 0) {
+        cell = cdr(cell);
+    }
+    for (LambdaScope *scope = lambdaScope; scope != NULL;
+         scope = scope->enclosing) {
+        if (!isTailCell(cell, scope->outer)) {
+            // Bound inside this lambda, so inside every enclosing one too
+            return;
+        }
+        if (!isBound(symbol->s, scope->lambda->freeNames)) {
+            scope->lambda->freeNames = cons(symbol, scope->lambda->freeNames);
         }
-        result = result + cur_node->d;
-        args = cdr(args);
     }
-    else {
-        result = result + cur_node->i;
-        args = cdr(args);
+}
+
+// Marks every symbol reference in expr that can only ever resolve to a global
+// binding as cacheable, and every other one as uncacheable. bound lists the
+// variables introduced by enclosing lambdas, lets and local defines; any
+// reference to one of those might be local, so it is never cached.
+void resolveGlobals(Value *expr, Value *bound) {
+    if (expr->type == SYMBOL_TYPE) {
+        if (isBound(expr->s, bound)) {
+            expr->sym.version = SYMBOL_UNCACHED;
+            noteFreeReference(expr, bound);
+        }
+        else if (expr->sym.version == SYMBOL_UNCACHED) {
+            expr->sym.version = 0;
+        }
+        return;
     }
-    
-    // And subtract subsequent arguments
-    while (args->type != NULL_TYPE) {
-        Value *cur_node = car(args);
-        if (cur_node->type != INT_TYPE) {
-            if (cur_node->type != DOUBLE_TYPE) {
-                evaluationError(10);
+    if (expr->type != CONS_TYPE) {
+        return;
+    }
+    Value *first = car(expr);
+    Value *args = cdr(expr);
+    if (first->type == SYMBOL_TYPE && args->type == CONS_TYPE) {
+        if (strcmp(first->s, "quote") == 0) {
+            return;
+        }
+        else if (strcmp(first->s, "lambda") == 0) {
+            // Parameters and local defines are bound in the body
+            Value *inner = collectDefines(cdr(args), bound);
+            for (Value *param = car(args); param->type == CONS_TYPE;
+                 param = cdr(param)) {
+                inner = cons(car(param), inner);
             }
-            result = result - cur_node->d;
-            args = cdr(args);
+            if (cdr(args)->type != CONS_TYPE) {
+                // Malformed; evalLambda will report it
+                return;
+            }
+            LambdaScope scope;
+            scope.lambda = describeLambda(args);
+            scope.outer = bound;
+            scope.enclosing = lambdaScope;
+            lambdaScope = &scope;
+            for (Value *body = cdr(args); body->type == CONS_TYPE;
+                 body = cdr(body)) {
+                resolveGlobals(car(body), inner);
+            }
+            lambdaScope = scope.enclosing;
+            first->sym.lambda = scope.lambda;
+            scope.lambda->flat = 1;
+            for (Value *name = scope.lambda->freeNames;
+                 name->type == CONS_TYPE; name = cdr(name)) {
+                if (isBound(car(name)->s, localDefines)) {
+                    scope.lambda->flat = 0;
+                }
+            }
+            return;
+        }
+        else if (strcmp(first->s, "let") == 0 ||
+                 strcmp(first->s, "let*") == 0 ||
+                 strcmp(first->s, "letrec") == 0) {
+            // Treating every name as bound in every initializer is more than
+            // let needs, but is still safe
+            Value *inner = collectLetNames(car(args), bound);
+            inner = collectDefines(cdr(args), inner);
+            if (strcmp(first->s, "letrec") == 0) {
+                // Closures made in the initializers are made before these
+                // names are bound, so they behave like local defines
+                localDefines = collectLetNames(car(args), localDefines);
+            }
+            Value *outer = bound;
+            if (strcmp(first->s, "let") != 0) {
+                outer = inner;
+            }
+            for (Value *binding = car(args); binding->type == CONS_TYPE;
+                 binding = cdr(binding)) {
+                if (car(binding)->type == CONS_TYPE &&
+                    cdr(car(binding))->type == CONS_TYPE) {
+                    resolveGlobals(car(cdr(car(binding))), outer);
+                }
+            }
+            for (Value *body = cdr(args); body->type == CONS_TYPE;
+                 body = cdr(body)) {
+                resolveGlobals(car(body), inner);
+            }
+            return;
+        }
+        else if (strcmp(first->s, "define") == 0 ||
+                 strcmp(first->s, "define-memoized") == 0 ||
+                 strcmp(first->s, "set!") == 0) {
+            // The variable being assigned isn't a reference
+            for (Value *rest = cdr(args); rest->type == CONS_TYPE;
+                 rest = cdr(rest)) {
+                resolveGlobals(car(rest), bound);
+            }
+            return;
+        }
+        else if (strcmp(first->s, "define-record-type") == 0) {
+            // Only names, no expressions
+            return;
+        }
+    }
+    // Anything else, including the head of an application
+    while (expr->type == CONS_TYPE) {
+        resolveGlobals(car(expr), bound);
+        expr = cdr(expr);
+    }
+}
+
+void redescribeLambda(struct Lambda *lambda, Value *bound) {
+    Value *head = talloc(sizeof(Value));
+    head->type = SYMBOL_TYPE;
+    head->s = "lambda";
+    head->sym.lambda = NULL;
+    head->sym.version = SYMBOL_UNCACHED;
+    Value *expr = cons(head, cons(lambda->paramNames,
+                                  cons(lambda->functionCode, makeNull())));
+    // Nothing can define a new variable in a copied frame, so only defines
+    // in the lambda itself need to stop it being flat
+    LambdaScope *enclosing = lambdaScope;
+    Value *defines = localDefines;
+    lambdaScope = NULL;
+    localDefines = collectDefines(cdr(expr), makeNull());
+    resolveGlobals(expr, bound);
+    lambdaScope = enclosing;
+    localDefines = defines;
+    if (head->sym.lambda != NULL) {
+        *lambda = *head->sym.lambda;
+    }
+}
+
+// Evaluation is recursive in C, one or more C stack frames for every level of
+// Scheme expression nesting, so a deep non-tail recursion in a program needs a
+// deep C stack. eval() checks how much of the current stack is left, and when
+// it is running low carries on in a new segment of stack allocated from the
+// heap, returning to the old one when that evaluation is done. Recursion
+// depth is then only limited by memory, and by maxDepth, which bounds the
+// number of procedure calls in progress so that runaway recursion ends with an
+// error rather than by exhausting memory.
+#define STACK_SEGMENT_SIZE (8 * 1024 * 1024)
+#define STACK_RED_ZONE (256 * 1024)
+#define SPARE_SEGMENTS 4
+
+unsigned long maxDepth = DEFAULT_MAX_DEPTH;
+
+__thread FILE *outputFile = NULL;
+
+// Every thread evaluating Scheme code (the main one, and future workers) has
+// its own stack, and so its own depth, limit and segments
+__thread unsigned long callDepth = 0;
+
+// eval() switches to a new segment once the stack pointer goes below this,
+// which is threadStackLimit when on the thread's own stack
+__thread char *stackLimit = NULL;
+__thread char *threadStackLimit = NULL;
+
+typedef struct StackSegment {
+    struct StackSegment *next;
+    ucontext_t context;
+    ucontext_t caller;
+    Value *tree;
+    Frame *frame;
+    Value *result;
+    char stack[];
+} StackSegment;
+
+// The segment being run on, and segments kept for reuse. Segments in use are
+// linked through next to the one they were entered from.
+__thread StackSegment *currentSegment = NULL;
+__thread StackSegment *spareSegments = NULL;
+__thread int spareCount = 0;
+
+void initStackLimit(size_t size) {
+    stackLimit = (char *) __builtin_frame_address(0) - size + STACK_RED_ZONE;
+    threadStackLimit = stackLimit;
+}
+
+// Sets the stack limit for a thread that didn't call initStackLimit, from the
+// size of its stack
+void initOwnStackLimit() {
+    size_t size = STACK_SEGMENT_SIZE;
+    pthread_attr_t attributes;
+    if (pthread_getattr_np(pthread_self(), &attributes) == 0) {
+        size_t stack_size;
+        if (pthread_attr_getstacksize(&attributes, &stack_size) == 0 &&
+            stack_size < size) {
+            size = stack_size;
+        }
+        pthread_attr_destroy(&attributes);
+    }
+    initStackLimit(size);
+}
+
+void saveEvalStack(EvalStack *state) {
+    state->stackLimit = stackLimit;
+    state->segment = currentSegment;
+    state->callDepth = callDepth;
+}
+
+void restoreEvalStack(EvalStack *state) {
+    stackLimit = state->stackLimit;
+    currentSegment = state->segment;
+    callDepth = state->callDepth;
+}
+
+void newEvalStack(EvalStack *state, char *stack, size_t size) {
+    state->stackLimit = stack + STACK_RED_ZONE;
+    state->segment = NULL;
+    state->callDepth = 0;
+}
+
+// Returns segment and the ones it was entered from to the spares
+void releaseSegments(StackSegment *segment) {
+    while (segment != NULL) {
+        StackSegment *next = segment->next;
+        if (spareCount < SPARE_SEGMENTS) {
+            segment->next = spareSegments;
+            spareSegments = segment;
+            spareCount++;
         }
         else {
-            result = result - cur_node->i;
-            args = cdr(args);
+            free(segment);
         }
+        segment = next;
     }
-    // Return value of result
-    Value *result_val = talloc(sizeof(Value));
-    result_val->type = DOUBLE_TYPE;
-    result_val->d = result;
-    return result_val;
 }
 
-void bind(char *name, Value *(*function)(struct Value *), Frame *frame) {
-    // Add primitive functions to top-level bindings list
-    Value *fun_val = talloc(sizeof(Value));
-    fun_val->type = PRIMITIVE_TYPE;
-    fun_val->pf = function;
-    // Add binding of name to value
-    Value *symbol = talloc(sizeof(Value));
-    symbol->type = SYMBOL_TYPE;
-    symbol->s = name;
+void freeEvalStack(EvalStack *state) {
+    releaseSegments(state->segment);
+    state->segment = NULL;
+}
+
+void resetEvaluator() {
+    // The task the error happened in is abandoned along with its stack
+    resetTasks();
+    // Segments abandoned part way through go back to the spares
+    releaseSegments(currentSegment);
+    currentSegment = NULL;
+    stackLimit = threadStackLimit;
+    callDepth = 0;
+    lambdaScope = NULL;
+    // So are the futures it was running
+    abandonFutures();
+}
+
+// Entry point of a new stack segment
+void runSegment() {
+    StackSegment *segment = currentSegment;
+    segment->result = eval(segment->tree, segment->frame);
+}
+
+// Evaluates tree in frame on a fresh stack segment
+Value *evalOnNewSegment(Value *tree, Frame *frame) {
+    StackSegment *segment = spareSegments;
+    if (segment != NULL) {
+        spareSegments = segment->next;
+        spareCount--;
+    }
+    else {
+        segment = malloc(sizeof(StackSegment) + STACK_SEGMENT_SIZE);
+        if (segment == NULL) {
+            evaluationError(16);
+        }
+    }
+    getcontext(&segment->context);
+    segment->context.uc_stack.ss_sp = segment->stack;
+    segment->context.uc_stack.ss_size = STACK_SEGMENT_SIZE;
+    segment->context.uc_link = &segment->caller;
+    makecontext(&segment->context, runSegment, 0);
+    segment->tree = tree;
+    segment->frame = frame;
     
-    Value *binding = makeNull();
-    binding = cons(fun_val, binding);
-    binding = cons(symbol, binding);
+    StackSegment *previous = currentSegment;
+    char *previous_limit = stackLimit;
+    segment->next = previous;
+    currentSegment = segment;
+    stackLimit = segment->stack + STACK_RED_ZONE;
+    swapcontext(&segment->caller, &segment->context);
+    currentSegment = previous;
+    stackLimit = previous_limit;
     
-    frame->bindings = cons(binding, frame->bindings);
+    Value *result = segment->result;
+    if (spareCount < SPARE_SEGMENTS) {
+        segment->next = spareSegments;
+        spareSegments = segment;
+        spareCount++;
+    }
+    else {
+        free(segment);
+    }
+    return result;
 }
 
-// Interprets input scheme code and prints results to command line
-void interpret(Value *tree) {
-    // Create a global frame in function call
+Frame *makeGlobalFrame() {
     Frame *global = talloc(sizeof(Frame));
     global->bindings = makeNull();
+    global->parent = NULL;
+    
+    for (int i = 0; primitives[i].name != NULL; i++) {
+        bind(&primitives[i], global);
+    }
     
-    bind("+", primitiveAdd, global);
-    bind("-", primitiveSubtract, global);
-    bind("*", primitiveMultiply, global);
-    bind("/", primitiveDivide, global);
-    bind(">", primitiveGreaterThan, global);
-    bind("<", primitiveLessThan, global);
-    bind(">=", primitiveGreaterOrEqual, global);
-    bind("<=", primitiveLessOrEqual, global);
-    bind("=", primitiveEquals, global);
-    bind("modulo", primitiveModulo, global);
-    bind("null?", primitiveNull, global);
-    bind("car", primitiveCar, global);
-    bind("cdr", primitiveCdr, global);
-    bind("cons", primitiveCons, global);
+    // Anything cached against an older global frame is now stale
+    __atomic_add_fetch(&globalVersion, 1, __ATOMIC_RELAXED);
+    return global;
+}
+
+void interpretIn(Value *tree, Frame *global, int print) {
+    if (stackLimit == NULL) {
+        initOwnStackLimit();
+    }
+    if (outputFile == NULL) {
+        outputFile = stdout;
+    }
+    callDepth = 0;
     
     // Iterates through input parse tree, evaluating S-expressions and
     // printing results
@@ -674,46 +1858,114 @@ void interpret(Value *tree) {
         assert((*tree).type == CONS_TYPE);
         // Evaluate individual expression...
         Value *expression = car(tree);
+        localDefines = makeNull();
+        if (expression->type == CONS_TYPE) {
+            // A top level define's own name is global
+            Value *below = expression;
+            if (car(expression)->type == SYMBOL_TYPE &&
+                (strcmp(car(expression)->s, "define") == 0 ||
+                 strcmp(car(expression)->s, "define-memoized") == 0)) {
+                below = cdr(expression);
+            }
+            localDefines = collectDefines(cdr(below), localDefines);
+        }
+        resolveGlobals(expression, makeNull());
         Value *result = eval(expression, global);
+        tree = cdr(tree);
+        if (!print) {
+            continue;
+        }
         // And print resulting Value appropriately
         switch ((*result).type) {
             case BOOL_TYPE:
                 if ((*result).i == 0) {
-                    printf("#f\n");
+                    fprintf(outputFile, "#f\n");
                 }
                 else {
-                    printf("#t\n");
+                    fprintf(outputFile, "#t\n");
                 }
                 break;
             case INT_TYPE:
-                printf("%i\n", (*result).i);
+                fprintf(outputFile, "%i\n", (*result).i);
                 break;
             case DOUBLE_TYPE:
-                printf("%f\n", (*result).d);
+                fprintf(outputFile, "%f\n", (*result).d);
                 break;
             case STR_TYPE:
-                printf("\"%s\"\n", (*result).s);
+                fprintf(outputFile, "\"%.*s\"\n", (int) (*result).str.length,
+                        (*result).str.chars);
                 break;
             case SYMBOL_TYPE:
-                printf("%s\n", (*result).s);
+                fprintf(outputFile, "%s\n", (*result).s);
                 break;
             case CONS_TYPE:
-                printf("(");
+                fprintf(outputFile, "(");
                 printTree(result);
-                printf(")\n");
+                fprintf(outputFile, ")\n");
                 break;
             case CLOSURE_TYPE:
-                printf("#<procedure>\n");
+                fprintf(outputFile, "#<procedure>\n");
                 break;
             case PRIMITIVE_TYPE:
-                printf("#<procedure>\n");
+                fprintf(outputFile, "#<procedure>\n");
+                break;
+            case MEMOIZED_TYPE:
+                fprintf(outputFile, "#<procedure>\n");
+                break;
+            case HASH_TYPE:
+                fprintf(outputFile, "#<hash-table>\n");
+                break;
+            case PMAP_TYPE:
+                fprintf(outputFile, "#<pmap>\n");
+                break;
+            case FUTURE_TYPE:
+                fprintf(outputFile, "#<future>\n");
+                break;
+            case ACTOR_TYPE:
+                fprintf(outputFile, "#<actor>\n");
+                break;
+            case CHANNEL_TYPE:
+                fprintf(outputFile, "#<channel>\n");
+                break;
+            case RECORD_TYPE:
+                fprintf(outputFile, "#<record %s>\n",
+                        result->record->type->name);
+                break;
+            case RECORD_PROC_TYPE:
+                fprintf(outputFile, "#<procedure>\n");
+                break;
+            case BYTEVECTOR_TYPE:
+                printBytevector(result);
+                fprintf(outputFile, "\n");
                 break;
             case NULL_TYPE:
-                printf("()\n");
+                fprintf(outputFile, "()\n");
                 break;
         }
-        tree = cdr(tree);
     }
+    // Tasks still able to run are run to the end, or until they wait on a
+    // channel nothing will put to
+    runTasks();
+    // Futures nobody touched may still be running on memory the caller is
+    // about to free
+    futureWaitAll();
+}
+
+// Evaluates every expression in the parse tree in a fresh global frame,
+// printing the results to the command line when print is set
+void interpretTree(Value *tree, int print) {
+    interpretIn(tree, makeGlobalFrame(), print);
+}
+
+// Interprets input scheme code and prints results to command line
+void interpret(Value *tree) {
+    interpretTree(tree, 1);
+}
+
+// Interprets input scheme code without printing the results, for running a
+// program repeatedly to time it
+void interpretQuietly(Value *tree) {
+    interpretTree(tree, 0);
 }
 
 // Finds and returns Value bound to argument symbol in argument Frame or
@@ -721,14 +1973,16 @@ void interpret(Value *tree) {
 Value *lookUpSymbol(Value *symbol, Frame *frame) {
     // Searches for symbol in each frame above input frame
     while (frame != NULL) {
-        Value *bindings = frame->bindings;
+        // Acquired, as the global frame may gain bindings on another thread
+        // while a future looks in it
+        Value *bindings = __atomic_load_n(&frame->bindings, __ATOMIC_ACQUIRE);
         // While loop in case bindings member of frame not assigned
         while (bindings == NULL) {
             if (frame->parent == NULL) {
                 evaluationError(3);
             }
             frame = frame->parent;
-            bindings = frame->bindings;
+            bindings = __atomic_load_n(&frame->bindings, __ATOMIC_ACQUIRE);
         }
         // Iterates through bindings...
         while ((*bindings).type != NULL_TYPE) {
@@ -737,7 +1991,17 @@ Value *lookUpSymbol(Value *symbol, Frame *frame) {
             assert(symbol1->type == SYMBOL_TYPE);
             // Checks if string member of binding matches that of input symbol
             if (strcmp((*symbol1).s, (*symbol).s) == 0) {
-                return car(cdr(symbol1_cons));
+                // Remember global bindings in the reference's inline cache
+                if (frame->parent == NULL &&
+                    symbol->sym.version != SYMBOL_UNCACHED) {
+                    // Published after the cell, for other threads reading
+                    // the cache in eval()
+                    symbol->sym.cell = symbol1_cons;
+                    __atomic_store_n(&symbol->sym.version, globalVersion,
+                                     __ATOMIC_RELEASE);
+                }
+                return car(__atomic_load_n(&symbol1_cons->c.cdr,
+                                           __ATOMIC_ACQUIRE));
             }
             // Otherwise continues search
             else {
@@ -862,9 +2126,11 @@ Value *evalLetStar(Value *args, Frame *frame) {
 }
 
 Value *evalLetRec(Value *args, Frame *frame) {
-    // Create new frame and set input frame to be parent frame
+    // Create new frame and set input frame to be parent frame. It has no
+    // bindings until every initializer has been evaluated.
     Frame *new_frame = talloc(sizeof(Frame));
     new_frame->parent = frame;
+    new_frame->bindings = makeNull();
     // Create new linked list to store bindings created in let statement
     Value *new_bindings = makeNull();
     
@@ -882,6 +2148,9 @@ Value *evalLetRec(Value *args, Frame *frame) {
         Value *val = cons(pointer,makeNull());
         Value *symbol_val = car(car(cur_node));
         if (symbol_val->type == SYMBOL_TYPE) {
+            if (profiling && pointer->type == CLOSURE_TYPE) {
+                profileName(pointer->cl.lambda->functionCode, symbol_val->s);
+            }
             val = cons(symbol_val, val);
         }
         else {
@@ -899,7 +2168,9 @@ Value *evalLetRec(Value *args, Frame *frame) {
     return eval(car(cdr(args)), new_frame);
 }
 
-Value *evalDefine(Value *args, Frame *frame) {
+// Evaluates define, or define-memoized when memoized is set, which binds the
+// variable to a memoized version of the procedure instead
+Value *evalDefine(Value *args, Frame *frame, int memoized) {
     Value *var = car(args);
     Value *expr = car(cdr(args));
     
@@ -910,11 +2181,23 @@ Value *evalDefine(Value *args, Frame *frame) {
     
     // Evaluates expression and sets up in global frame
     Value *eval_expr = eval(expr, frame);
+    if (profiling && eval_expr->type == CLOSURE_TYPE) {
+        profileName(eval_expr->cl.lambda->functionCode, var->s);
+    }
+    if (memoized) {
+        eval_expr = makeMemoized(eval_expr);
+    }
     Value *new_bindings = makeNull();
     new_bindings = cons(eval_expr, new_bindings);
     new_bindings = cons(var, new_bindings);
     
-    frame->bindings = cons(new_bindings, frame->bindings);
+    // Published whole, for futures looking in the frame
+    __atomic_store_n(&frame->bindings, cons(new_bindings, frame->bindings),
+                     __ATOMIC_RELEASE);
+    // A new global binding may shadow one that references have cached
+    if (frame->parent == NULL) {
+        __atomic_add_fetch(&globalVersion, 1, __ATOMIC_RELAXED);
+    }
     
     // Returns void Value for interpreter to ignore
     Value *void_val = talloc(sizeof(Value));
@@ -923,39 +2206,120 @@ Value *evalDefine(Value *args, Frame *frame) {
     return void_val;
 }
 
-Value *apply(Value *function, Value *args) {
-    // Applies given function to multiple arguments
-    assert(function->type == CLOSURE_TYPE || function->type == PRIMITIVE_TYPE);
+// Evaluates define-record-type, binding each procedure it defines in frame
+Value *evalDefineRecordType(Value *args, Frame *frame) {
+    Value *bindings = recordTypeProcedures(args);
+    for (; bindings->type != NULL_TYPE; bindings = cdr(bindings)) {
+        __atomic_store_n(&frame->bindings, cons(car(bindings), frame->bindings),
+                         __ATOMIC_RELEASE);
+    }
+    // The new global bindings may shadow ones that references have cached
+    if (frame->parent == NULL) {
+        __atomic_add_fetch(&globalVersion, 1, __ATOMIC_RELAXED);
+    }
+    return voidVal();
+}
+
+// Makes a cons cell for the bindings of a call frame, on the stack region if
+// the frame is local to the call
+Value *frameCons(Value *car, Value *cdr, int local) {
+    if (!local) {
+        return cons(car, cdr);
+    }
+    Value *cell = salloc(sizeof(Value));
+    cell->type = CONS_TYPE;
+    cell->c.car = car;
+    cell->c.cdr = cdr;
+    return cell;
+}
+
+// Applies a memoized procedure, returning the stored result when there is one
+// for these arguments. The key looked up with is built on the stack region,
+// so a hit allocates nothing; on a miss a copy is made on the heap to store.
+Value *applyMemoized(struct Memo *memo, int argc, Value **argv) {
+    void *mark = smark();
+    Value *key = salloc(sizeof(Value));
+    key->type = NULL_TYPE;
+    for (int i = argc - 1; i >= 0; i--) {
+        Value *cell = salloc(sizeof(Value));
+        cell->type = CONS_TYPE;
+        cell->c.car = argv[i];
+        cell->c.cdr = key;
+        key = cell;
+    }
+    Value *result = hashGet(memo->table, key);
+    srelease(mark);
+    // Counted atomically, as futures may share the procedure
+    if (result != NULL) {
+        __atomic_fetch_add(&memo->hits, 1, __ATOMIC_RELAXED);
+        return result;
+    }
+    __atomic_fetch_add(&memo->misses, 1, __ATOMIC_RELAXED);
+    result = apply(memo->function, argc, argv);
+    key = makeNull();
+    for (int i = argc - 1; i >= 0; i--) {
+        key = cons(argv[i], key);
+    }
+    hashPut(memo->table, key, result);
+    return result;
+}
+
+// Applies given function to the argc arguments in argv
+Value *apply(Value *function, int argc, Value **argv) {
+    assert(isProcedure(function));
+    
+    if (function->type == MEMOIZED_TYPE) {
+        return applyMemoized(function->memo, argc, argv);
+    }
     
     if (function->type == PRIMITIVE_TYPE) {
-        return function->pf(args);
+        Primitive *primitive = function->prim;
+        if (argc < primitive->minArgs ||
+            (primitive->maxArgs >= 0 && argc > primitive->maxArgs)) {
+            evaluationError(10);
+        }
+        return primitive->function(argc, argv);
+    }
+    
+    if (function->type == RECORD_PROC_TYPE) {
+        return applyRecordProcedure(function->recordProc, argc, argv);
     }
     
     struct Closure closure = function->cl;
+    int local = closure.lambda->localFrame;
+    void *mark = NULL;
     
     // Sets up new frame for execution of body of code in closure
-    Frame *frame = talloc(sizeof(Frame));
+    Frame *frame;
+    Value *null_val;
+    if (local) {
+        mark = smark();
+        frame = salloc(sizeof(Frame));
+        null_val = salloc(sizeof(Value));
+        null_val->type = NULL_TYPE;
+    }
+    else {
+        frame = talloc(sizeof(Frame));
+        null_val = makeNull();
+    }
     frame->parent = closure.frame;
     
-    Value *new_bindings = makeNull();
-    Value *cur_node = args;
-    Value *params = closure.paramNames;
+    Value *new_bindings = null_val;
+    Value *params = closure.lambda->paramNames;
     Value *cur_param = params;
     
     // Sets up list of bindings based on parameters
-    while (cur_node->type != NULL_TYPE) {
+    for (int i = 0; i < argc; i++) {
         if (cur_param->type == NULL_TYPE) {
             // If too many parameters are passed into function
             evaluationError(8);
         }
         
-        Value *list = makeNull();
-        list = cons(car(cur_node), list);
-        list = cons(car(cur_param), list);
+        Value *list = frameCons(argv[i], null_val, local);
+        list = frameCons(car(cur_param), list, local);
         
-        new_bindings = cons(list, new_bindings);
+        new_bindings = frameCons(list, new_bindings, local);
         
-        cur_node = cdr(cur_node);
         cur_param = cdr(cur_param);
     }
     // If there are less parameters passed than what function needs
@@ -964,24 +2328,101 @@ Value *apply(Value *function, Value *args) {
     }
     
     frame->bindings = new_bindings;
-    Value *body = closure.functionCode;
+    Value *body = closure.lambda->functionCode;
     
-    return eval(body, frame);
+    if (++callDepth > maxDepth) {
+        evaluationError(16);
+    }
+    Value *result;
+    if (profiling) {
+        profileEnter(function);
+        result = eval(body, frame);
+        profileExit();
+    }
+    else {
+        result = eval(body, frame);
+    }
+    callDepth--;
+    if (local) {
+        srelease(mark);
+    }
+    return result;
 }
 
-Value *evalLambda(Value *args, Frame *frame) {
+// Evaluates every argument of a call into an array on the C stack, in order,
+// and applies function to them
+Value *evalCall(Value *function, Value *args, Frame *frame) {
+    int argc = length(args);
+    Value *argv[argc + 1];
+    for (int i = 0; i < argc; i++) {
+        argv[i] = eval(car(args), frame);
+        args = cdr(args);
+    }
+    return apply(function, argc, argv);
+}
+
+// Returns the binding cell for name in frame or one of its parents, stopping
+// short of the global frame, or NULL if there isn't one
+Value *findLocalBinding(char *name, Frame *frame) {
+    while (frame != NULL && frame->parent != NULL) {
+        Value *bindings = frame->bindings;
+        while (bindings != NULL && bindings->type != NULL_TYPE) {
+            if (strcmp(car(car(bindings))->s, name) == 0) {
+                return car(bindings);
+            }
+            bindings = cdr(bindings);
+        }
+        frame = frame->parent;
+    }
+    return NULL;
+}
+
+// Makes the frame a flat closure captures: one holding just the bindings of
+// its free variables, whose parent is the global frame. The binding cells are
+// shared with the frames they came from rather than copied, so a set! through
+// either one is seen by both. Returns NULL if some free variable isn't bound
+// yet, as happens inside letrec, in which case the whole frame is captured.
+Frame *flatFrame(struct Lambda *lambda, Frame *frame) {
+    Frame *global = frame;
+    while (global->parent != NULL) {
+        global = global->parent;
+    }
+    if (lambda->freeNames->type == NULL_TYPE) {
+        return global;
+    }
+    Value *bindings = makeNull();
+    for (Value *name = lambda->freeNames; name->type == CONS_TYPE;
+         name = cdr(name)) {
+        Value *cell = findLocalBinding(car(name)->s, frame);
+        if (cell == NULL) {
+            return NULL;
+        }
+        bindings = cons(cell, bindings);
+    }
+    Frame *flat = talloc(sizeof(Frame));
+    flat->bindings = bindings;
+    flat->parent = global;
+    return flat;
+}
+
+Value *evalLambda(Value *args, Frame *frame, struct Lambda *lambda) {
     // Sets up a closure and returns the closure type Value
-    if (args->type != CONS_TYPE) {
-        evaluationError(7);
+    if (lambda == NULL) {
+        lambda = describeLambda(args);
     }
-    // Extracts body and parameters from input arguments
-    Value *params = car(args);
-    Value *body = car(cdr(args));
     
     struct Closure cl;
-    cl.paramNames = params;
-    cl.functionCode = body;
+    cl.lambda = lambda;
     cl.frame = frame;
+    // A frame just below the global one is as short a chain as a flat frame
+    // would give, so it is captured as it is
+    if (lambda->flat && frame->parent != NULL &&
+        frame->parent->parent != NULL) {
+        Frame *flat = flatFrame(lambda, frame);
+        if (flat != NULL) {
+            cl.frame = flat;
+        }
+    }
     
     Value* closure = talloc(sizeof(Value));
     closure->type = CLOSURE_TYPE;
@@ -1012,9 +2453,10 @@ Value *evalSet(Value *args, Frame *frame) {
             assert(symbol1->type == SYMBOL_TYPE);
             // Checks if string member of binding matches that of input symbol
             if (strcmp((*symbol1).s, (*symbol).s) == 0) {
-                struct ConsCell cons_cell = symbol1_cons->c;
-                cons_cell.cdr = cons(new_val, makeNull());
-                symbol1_cons->c = cons_cell;
+                // Published whole, for futures reading the variable on
+                // other threads
+                __atomic_store_n(&symbol1_cons->c.cdr,
+                                 cons(new_val, makeNull()), __ATOMIC_RELEASE);
                 
                 Value *void_val = talloc(sizeof(Value));
                 void_val->type = VOID_TYPE;
@@ -1033,18 +2475,13 @@ Value *evalSet(Value *args, Frame *frame) {
 }
 
 Value *evalBegin(Value *args, Frame *frame) {
-    // Evaluates every argument
-    Value *evaledArgs = evalEach(args, frame);
-    
-    Value *cur_val = evaledArgs;
-    // Goes through linked list to retrieve the final value and return it
-    while (cur_val->type != NULL_TYPE) {
-        if (cdr(cur_val)->type == NULL_TYPE) {
-            return car(cur_val);
-        }
-        else {
-            cur_val = cdr(cur_val);
+    // Evaluates every argument, returning the value of the final one
+    while (args->type != NULL_TYPE) {
+        Value *evaled_arg = eval(car(args), frame);
+        if (cdr(args)->type == NULL_TYPE) {
+            return evaled_arg;
         }
+        args = cdr(args);
     }
     // Void Value used as stand in if the Begin isn't passed any arguments
     Value *void_val = talloc(sizeof(Value));
@@ -1126,6 +2563,9 @@ Value *evalOr(Value *args, Frame *frame) {
 
 // Eval block
 Value *eval(Value *tree, Frame *frame) {
+    if ((char *) __builtin_frame_address(0) < stackLimit) {
+        return evalOnNewSegment(tree, frame);
+    }
     Value *result;
     switch (tree->type) {
         // For int, bool, double, and string type, we simply return tree
@@ -1141,9 +2581,17 @@ Value *eval(Value *tree, Frame *frame) {
         case BOOL_TYPE:
             result = tree;
             break;
-        // Looks for symbol in frames
+        // Looks for symbol in frames, unless the reference has already been
+        // resolved to a global binding that is still current
         case SYMBOL_TYPE:
-            result = lookUpSymbol(tree, frame);
+            if (__atomic_load_n(&tree->sym.version, __ATOMIC_ACQUIRE) ==
+                globalVersion) {
+                result = __atomic_load_n(&tree->sym.cell->c.cdr,
+                                         __ATOMIC_ACQUIRE)->c.car;
+            }
+            else {
+                result = lookUpSymbol(tree, frame);
+            }
             break;
         case CONS_TYPE:
             {
@@ -1174,11 +2622,19 @@ Value *eval(Value *tree, Frame *frame) {
                 }
 
                 else if (strcmp(first_arg->s, "define") == 0) {
-                    result = evalDefine(args, frame);
+                    result = evalDefine(args, frame, 0);
+                }
+
+                else if (strcmp(first_arg->s, "define-memoized") == 0) {
+                    result = evalDefine(args, frame, 1);
+                }
+
+                else if (strcmp(first_arg->s, "define-record-type") == 0) {
+                    result = evalDefineRecordType(args, frame);
                 }
 
                 else if (strcmp(first_arg->s, "lambda") == 0) {
-                    result = evalLambda(args, frame);
+                    result = evalLambda(args, frame, first_arg->sym.lambda);
                 }
                 
                 else if (strcmp(first_arg->s, "set!") == 0) {
@@ -1205,8 +2661,7 @@ Value *eval(Value *tree, Frame *frame) {
                     // If not a special form, evaluate the first
                     // evaluate the args, then apply the first to the args.
                     Value *evaledOperator = eval(first_arg, frame);
-                    Value *evaledArgs = evalEach(args, frame);
-                    return apply(evaledOperator, evaledArgs);
+                    return evalCall(evaledOperator, args, frame);
                 }
                 
             }
@@ -1215,8 +2670,7 @@ Value *eval(Value *tree, Frame *frame) {
                 // If not a special form, evaluate the first, evaluate the args, then
                 // apply the first to the args.
                 Value *evaledOperator = eval(first_arg, frame);
-                Value *evaledArgs = evalEach(args, frame);
-                return apply(evaledOperator, evaledArgs);
+                return evalCall(evaledOperator, args, frame);
             }
             break;
             }
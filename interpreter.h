@@ -1,10 +1,89 @@
+#include <stddef.h>
+#include <stdio.h>
+#include "value.h"
+
 #ifndef _INTERPRETER
 #define _INTERPRETER
 
+// A primitive function and the name it is bound to in the global frame. The
+// function is passed its arguments as an array of argc Values, which apply()
+// has already checked holds between minArgs and maxArgs of them (a maxArgs of
+// -1 means no limit).
+typedef struct Primitive {
+    char *name;
+    Value *(*function)(int argc, Value **argv);
+    int minArgs;
+    int maxArgs;
+    int pure;
+} Primitive;
+
+// Returns the primitive bound to name in every global frame, or NULL if none
+Primitive *findPrimitive(char *name);
+
+
+// Most procedure calls that may be in progress at once before evaluation stops
+// with an error; set by --max-depth. The evaluation stack grows on the heap as
+// needed, at a few hundred bytes per call.
+#define DEFAULT_MAX_DEPTH 2000000
+extern unsigned long maxDepth;
+
+// Where results and error messages are printed; stdout unless an embedding
+// program has given the thread somewhere else
+extern __thread FILE *outputFile;
 
 void interpret(Value *tree);
+void interpretQuietly(Value *tree);
 Value *eval(Value *expr, Frame *frame);
 
+// Returns a new global frame with every primitive bound in it
+Frame *makeGlobalFrame();
+
+// Evaluates every expression in the parse tree in the given global frame,
+// so definitions made by earlier trees evaluated in it are visible, printing
+// the results when print is set
+void interpretIn(Value *tree, Frame *global, int print);
+
+// Puts the calling thread's evaluator back in its starting state, after an
+// evaluation has been abandoned part way through by an error caught with
+// exitTrap
+void resetEvaluator();
+
+// Works out afresh what the evaluator knows about a lambda whose code is a copy
+// of another interpreter's, and so carries nothing worked out for it. bound
+// lists the local variables of the frames closures made from it have
+// captured; the description is updated in place.
+void redescribeLambda(struct Lambda *lambda, Value *bound);
+
+// Calls a procedure Value (closure, primitive or memoized) on argc arguments
+Value *apply(Value *function, int argc, Value **argv);
+
+// Tells the evaluator that the calling thread's C stack has size bytes, most
+// of them below the caller's frame. Every thread but the main one calls this
+// before evaluating anything.
+void initStackLimit(size_t size);
+
+// What the evaluator keeps about the C stack it is running on: where it must
+// move to a new segment, the segment it is on, and the calls in progress. A
+// green task switching to another task's stack saves its own and restores
+// the other's.
+typedef struct EvalStack {
+    char *stackLimit;
+    void *segment;
+    unsigned long callDepth;
+} EvalStack;
+
+void saveEvalStack(EvalStack *state);
+void restoreEvalStack(EvalStack *state);
+
+// Sets up state for a new stack of size bytes starting at stack
+void newEvalStack(EvalStack *state, char *stack, size_t size);
+
+// Frees the stack segments of a stack that will never run again
+void freeEvalStack(EvalStack *state);
+
+// Prints the message for evaluation error number error, and exits with texit
+void evaluationError(int error);
+
 
 #endif
 
@@ -4,21 +4,22 @@
 #include <stdbool.h>
 #include "talloc.h"
 #include "value.h"
+#include "linkedlist.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include "assert.h"
 
 // Create a new NULL_TYPE value node.
-Value *makeNull() {
-    Value *null_node = talloc(sizeof(Value));
+Value *makeNullSite(const char *site) {
+    Value *null_node = tallocSite(sizeof(Value), ALLOC_VALUE, site);
     (*null_node).type = NULL_TYPE;
     
     return null_node;
 }
 
 // Create a new CONS_TYPE value node.
-Value *cons(Value *car, Value *cdr) {
-    Value *cons_node = talloc(sizeof(Value));
+Value *consSite(Value *car, Value *cdr, const char *site) {
+    Value *cons_node = tallocSite(sizeof(Value), ALLOC_CONS, site);
     (*cons_node).type = CONS_TYPE;
     struct ConsCell cons_cell;
     cons_cell.car = car;
@@ -55,7 +56,8 @@ void display(Value *list) {
                     printf("%f, ", (*car_val).d);
                     break;
                 case STR_TYPE:
-                    printf("%s, ", (*car_val).s);
+                    printf("%.*s, ", (int) (*car_val).str.length,
+                           (*car_val).str.chars);
                     break;
                 case CONS_TYPE:
                     printf("\nInvalid LinkedList structure. Exiting.\n");
@@ -4,11 +4,14 @@
 #ifndef _LINKEDLIST
 #define _LINKEDLIST
 
-// Create a new NULL_TYPE value node.
-Value *makeNull();
+// Create a new NULL_TYPE value node. Like talloc, makeNull and cons are macros
+// so that the allocation is tagged with the name of the calling function.
+#define makeNull() makeNullSite(__func__)
+Value *makeNullSite(const char *site);
 
 // Create a new CONS_TYPE value node.
-Value *cons(Value *car, Value *cdr);
+#define cons(car, cdr) consSite((car), (cdr), __func__)
+Value *consSite(Value *car, Value *cdr, const char *site);
 
 // Display the contents of the linked list to the screen in some kind of readable format
 void display(Value *list);
@@ -1,17 +1,371 @@
 #include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "tokenizer.h"
 #include "value.h"
 #include "linkedlist.h"
 #include "parser.h"
 #include "talloc.h"
 #include "interpreter.h"
+#include "profiler.h"
+#include "optimizer.h"
+#include "future.h"
+#include "actor.h"
+#include "scheme.h"
 
-int main() {
+// Prints the command line options and exits with an error status
+void usage(char *program) {
+    fprintf(stderr, "usage: %s [options] < program.scm\n", program);
+    fprintf(stderr, "       %s [options] --batch program.scm ...\n", program);
+    fprintf(stderr, "  --profile            print per-procedure calls, time "
+                    "and allocations to stderr at exit\n");
+    fprintf(stderr, "  --alloc-stats        print allocation counts, bytes "
+                    "and peak live bytes per site at exit\n");
+    fprintf(stderr, "  --no-optimize        evaluate the parse tree exactly "
+                    "as parsed\n");
+    fprintf(stderr, "  --dump-optimized     print the optimized program "
+                    "instead of running it\n");
+    fprintf(stderr, "  --repeat N           evaluate the program N times "
+                    "without printing, and report latencies\n");
+    fprintf(stderr, "  --warmup M           untimed iterations to run before "
+                    "--repeat (default 0)\n");
+    fprintf(stderr, "  --sample FILE        sample the Scheme call stack and "
+                    "write folded stacks to FILE\n");
+    fprintf(stderr, "  --sample-rate HZ     samples per second of CPU time "
+                    "(default 1000)\n");
+    fprintf(stderr, "  --max-depth N        most nested procedure calls "
+                    "before stopping with an error\n"
+                    "                       (default %i)\n", DEFAULT_MAX_DEPTH);
+    fprintf(stderr, "  --threads N          threads to run futures on, "
+                    "including the main one\n"
+                    "                       (default one per processor)\n");
+    fprintf(stderr, "  --batch FILE ...     run each program in an interpreter "
+                    "of its own, --threads at a\n"
+                    "                       time, printing their output in "
+                    "order; not with --profile,\n"
+                    "                       --sample, --no-optimize, "
+                    "--dump-optimized, --repeat or --warmup\n");
+    texit(1);
+}
+
+// Current time in milliseconds from a monotonic clock
+double nowMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+// Orders latencies for taking percentiles
+int compareDoubles(const void *a, const void *b) {
+    double x = *(double *) a;
+    double y = *(double *) b;
+    return (x > y) - (x < y);
+}
+
+// Returns the pth percentile (nearest rank) of n sorted values
+double percentile(double *sorted, int n, int p) {
+    int rank = (n * p + 99) / 100;
+    if (rank < 1) {
+        rank = 1;
+    }
+    return sorted[rank - 1];
+}
+
+// Evaluates an already parsed program warmup + repeat times, each time in a
+// fresh global frame and with the allocations of the run freed afterwards,
+// then reports latency percentiles and allocations per timed iteration.
+void repeatProgram(Value *tree, int repeat, int warmup) {
+    double *latencies = malloc(sizeof(double) * repeat);
+    unsigned long allocs = 0;
+    unsigned long bytes = 0;
+    for (int i = 0; i < warmup + repeat; i++) {
+        void *mark = tmark();
+        unsigned long start_count = tallocCount;
+        unsigned long start_bytes = tallocBytes;
+        double start = nowMs();
+        interpretQuietly(tree);
+        double end = nowMs();
+        if (i >= warmup) {
+            latencies[i - warmup] = end - start;
+            allocs += tallocCount - start_count;
+            bytes += tallocBytes - start_bytes;
+        }
+        // The workers' allocations for the run go too, unless actors that
+        // may still use them are running
+        if (!actorsRunning()) {
+            futureFreeHeaps();
+        }
+        trelease(mark);
+    }
+
+    double total = 0;
+    for (int i = 0; i < repeat; i++) {
+        total += latencies[i];
+    }
+    qsort(latencies, repeat, sizeof(double), compareDoubles);
+    fprintf(stderr, "%i iterations after %i warmup\n", repeat, warmup);
+    fprintf(stderr, "latency ms: min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  "
+                    "max %.3f  mean %.3f\n",
+            latencies[0], percentile(latencies, repeat, 50),
+            percentile(latencies, repeat, 90), percentile(latencies, repeat, 99),
+            latencies[repeat - 1], total / repeat);
+    fprintf(stderr, "allocations per iteration: %lu (%lu bytes)\n",
+            allocs / repeat, bytes / repeat);
+    free(latencies);
+}
+
+// The programs of a --batch run. Each batch thread repeatedly takes the next
+// program nobody has started and runs it in an interpreter of its own, with
+// the output going to a buffer; the main thread prints the buffers in order,
+// each as soon as it and those before it are done.
+typedef struct BatchProgram {
+    char *path;
+    char *output;
+    size_t size;
+    int status;
+    int done;
+} BatchProgram;
+
+BatchProgram *batch;
+int batchCount;
+int batchNext = 0;
+pthread_mutex_t batchLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t batchDone = PTHREAD_COND_INITIALIZER;
+
+// Stack given to each batch thread
+#define BATCH_STACK_SIZE (8 * 1024 * 1024)
+
+// Body of each batch thread
+void *batchThread(void *unused) {
+    tallocThreadStart();
+    while (1) {
+        int index = __atomic_fetch_add(&batchNext, 1, __ATOMIC_RELAXED);
+        if (index >= batchCount) {
+            break;
+        }
+        BatchProgram *program = &batch[index];
+        FILE *input = fopen(program->path, "r");
+        FILE *output = open_memstream(&program->output, &program->size);
+        if (input == NULL || output == NULL) {
+            program->status = -2;
+        }
+        else {
+            Interp *interp = interp_new();
+            interp_set_output(interp, output);
+            program->status = interp_eval_program(interp, input);
+            interp_free(interp);
+        }
+        if (input != NULL) {
+            fclose(input);
+        }
+        if (output != NULL && actorsRunning()) {
+            // Actors the program spawned may still print to output, so it is
+            // left open, and what it holds so far copied
+            flockfile(output);
+            fflush(output);
+            char *copy = malloc(program->size);
+            if (copy != NULL) {
+                memcpy(copy, program->output, program->size);
+            }
+            program->output = copy;
+            program->size = copy != NULL ? program->size : 0;
+            funlockfile(output);
+        }
+        else if (output != NULL) {
+            fclose(output);
+        }
+        pthread_mutex_lock(&batchLock);
+        program->done = 1;
+        pthread_cond_broadcast(&batchDone);
+        pthread_mutex_unlock(&batchLock);
+    }
+    tallocThreadEnd();
+    return NULL;
+}
+
+// Runs each of count programs in an interpreter of its own, printing their
+// output in order, and returns 0 if they all ran without error
+int runBatch(char **paths, int count) {
+    batch = calloc(count, sizeof(BatchProgram));
+    batchCount = count;
+    for (int i = 0; i < count; i++) {
+        batch[i].path = paths[i];
+    }
+
+    int threads = futureThreads > 0 ? futureThreads
+                                    : sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > count) {
+        threads = count;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    pthread_t *ids = malloc(threads * sizeof(pthread_t));
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, BATCH_STACK_SIZE);
+    int started = 0;
+    while (started < threads &&
+           pthread_create(&ids[started], &attributes, batchThread, NULL) == 0) {
+        started++;
+    }
+    pthread_attr_destroy(&attributes);
+    if (started == 0) {
+        fprintf(stderr, "Can't start batch threads\n");
+        texit(1);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_lock(&batchLock);
+        while (!batch[i].done) {
+            pthread_cond_wait(&batchDone, &batchLock);
+        }
+        pthread_mutex_unlock(&batchLock);
+        if (batch[i].status == -2) {
+            fprintf(stderr, "Can't read %s\n", batch[i].path);
+        }
+        if (batch[i].output != NULL) {
+            fwrite(batch[i].output, 1, batch[i].size, stdout);
+            free(batch[i].output);
+        }
+        failed = failed || batch[i].status != 0;
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    free(ids);
+    free(batch);
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    char *sample_path = NULL;
+    int sample_rate = 1000;
+    int repeat = 0;
+    int warmup = 0;
+    int optimizing = 1;
+    int dump_optimized = 0;
+    int profile = 0;
+    char **batch_paths = NULL;
+    int batch_count = 0;
+    outputFile = stdout;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--profile") == 0) {
+            profile = 1;
+        }
+        else if (strcmp(argv[i], "--alloc-stats") == 0) {
+            tallocStatsStart();
+        }
+        else if (strcmp(argv[i], "--no-optimize") == 0) {
+            optimizing = 0;
+        }
+        else if (strcmp(argv[i], "--dump-optimized") == 0) {
+            dump_optimized = 1;
+        }
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            i++;
+            repeat = atoi(argv[i]);
+            if (repeat <= 0) {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            i++;
+            warmup = atoi(argv[i]);
+            if (warmup < 0) {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+            i++;
+            sample_path = argv[i];
+        }
+        else if (strcmp(argv[i], "--sample-rate") == 0 && i + 1 < argc) {
+            i++;
+            sample_rate = atoi(argv[i]);
+            if (sample_rate <= 0 || sample_rate > 1000000) {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc) {
+            i++;
+            long depth = atol(argv[i]);
+            if (depth <= 0) {
+                usage(argv[0]);
+            }
+            maxDepth = depth;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            i++;
+            futureThreads = atoi(argv[i]);
+            if (futureThreads <= 0) {
+                usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            // Everything after is a program to run
+            batch_paths = argv + i + 1;
+            batch_count = argc - i - 1;
+            break;
+        }
+        else {
+            usage(argv[0]);
+        }
+    }
+    if (batch_count > 0) {
+        // Batch programs are run optimized, on threads the profilers don't
+        // follow, and just once each
+        char *unsupported = profile ? "--profile"
+                          : sample_path != NULL ? "--sample"
+                          : !optimizing ? "--no-optimize"
+                          : dump_optimized ? "--dump-optimized"
+                          : repeat > 0 ? "--repeat"
+                          : warmup > 0 ? "--warmup"
+                          : NULL;
+        if (unsupported != NULL) {
+            fprintf(stderr, "%s can't be used with --batch\n", unsupported);
+            usage(argv[0]);
+        }
+    }
+    if (profile) {
+        profileStart();
+    }
+    if (sample_path != NULL) {
+        sampleStart(sample_path, sample_rate);
+    }
+
+    if (batch_count > 0) {
+        int failed = runBatch(batch_paths, batch_count);
+        if (!actorsRunning()) {
+            tfree();
+        }
+        return failed;
+    }
 
     Value *list = tokenize(stdin);
     Value *tree = parse(list);
-    interpret(tree);
+    if (optimizing) {
+        tree = optimize(tree);
+    }
+    if (dump_optimized) {
+        printProgram(tree);
+    }
+    else if (repeat > 0) {
+        repeatProgram(tree, repeat, warmup);
+    }
+    else {
+        interpret(tree);
+    }
 
-    tfree();
+    // Actors still running are using the memory tfree would free; the
+    // program ends without waiting for them
+    if (!actorsRunning()) {
+        tfree();
+    }
     return 0;
 }
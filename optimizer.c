@@ -0,0 +1,699 @@
+/* optimizer.c - Parse tree optimizations for use in interpreter project    */
+/* By Tore Banta & Charlie Sarano                                            */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "linkedlist.h"
+#include "value.h"
+#include "talloc.h"
+#include "parser.h"
+#include "interpreter.h"
+#include "optimizer.h"
+#include "record.h"
+
+// The optimizer rewrites the parse tree between parse() and interpret(). Every
+// rewrite has to give the same printed results and the same errors as
+// evaluating the original tree, so anything it isn't sure about is left alone.
+// New lists are built for rewritten expressions; atoms are shared with the
+// original tree.
+
+// Largest lambda body, counted in atoms, that calls may be inlined with
+#define INLINE_MAX_SIZE 16
+
+// Facts about the whole program being optimized, gathered by optimize()
+// before it starts rewriting: every name bound or assigned anywhere, every
+// name assigned with set!, and the global procedures found so far that calls
+// may be inlined with, as a list of (name lambda-expression) pairs. Kept per
+// thread, so interpreters on different threads can optimize at once.
+__thread Value *boundNames;
+__thread Value *assignedNames;
+__thread Value *inlinable;
+
+// Checks whether a Value evaluates to itself
+int isSelfEvaluating(Value *expr) {
+    return expr->type == INT_TYPE || expr->type == DOUBLE_TYPE ||
+           expr->type == BOOL_TYPE || expr->type == STR_TYPE;
+}
+
+// Checks whether expr is (quote datum)
+int isQuoted(Value *expr) {
+    return expr->type == CONS_TYPE && car(expr)->type == SYMBOL_TYPE &&
+           strcmp(car(expr)->s, "quote") == 0 && cdr(expr)->type == CONS_TYPE;
+}
+
+// Checks whether expr is a constant: a self-evaluating atom or quoted data
+int isConstant(Value *expr) {
+    return isSelfEvaluating(expr) || isQuoted(expr);
+}
+
+// Returns the value a constant expression evaluates to
+Value *constantValue(Value *expr) {
+    if (isQuoted(expr)) {
+        return car(cdr(expr));
+    }
+    return expr;
+}
+
+// Checks whether expr is the boolean literal #t (value 1) or #f (value 0)
+int isBoolLiteral(Value *expr, int value) {
+    return expr->type == BOOL_TYPE && expr->i == value;
+}
+
+// Checks whether expr is an application or special form headed by name
+int isForm(Value *expr, char *name) {
+    return expr->type == CONS_TYPE && car(expr)->type == SYMBOL_TYPE &&
+           strcmp(car(expr)->s, name) == 0;
+}
+
+// Makes a new symbol Value for use in rewritten trees
+Value *makeSymbol(char *name) {
+    Value *symbol = talloc(sizeof(Value));
+    symbol->type = SYMBOL_TYPE;
+    symbol->s = name;
+    symbol->sym.cell = NULL;
+    symbol->sym.version = SYMBOL_UNCACHED;
+    return symbol;
+}
+
+// Turns a computed value back into an expression that evaluates to it
+Value *makeConstant(Value *value) {
+    if (isSelfEvaluating(value)) {
+        return value;
+    }
+    return cons(makeSymbol("quote"), cons(value, makeNull()));
+}
+
+// Adds every variable name the program binds or assigns anywhere (define,
+// set!, lambda parameters, let names) to names. A primitive whose name is in
+// this list might not mean the primitive at some call site, so calls to it are
+// never folded. This is coarser than tracking scopes, but always safe.
+Value *collectBoundNames(Value *expr, Value *names) {
+    if (expr->type != CONS_TYPE) {
+        return names;
+    }
+    if (isQuoted(expr)) {
+        return names;
+    }
+    Value *first = car(expr);
+    Value *args = cdr(expr);
+    if (first->type == SYMBOL_TYPE && args->type == CONS_TYPE) {
+        if (strcmp(first->s, "define") == 0 ||
+            strcmp(first->s, "define-memoized") == 0 ||
+            strcmp(first->s, "set!") == 0) {
+            if (car(args)->type == SYMBOL_TYPE) {
+                names = cons(car(args), names);
+            }
+        }
+        else if (strcmp(first->s, "define-record-type") == 0) {
+            names = recordTypeNames(args, names);
+        }
+        else if (strcmp(first->s, "lambda") == 0) {
+            for (Value *param = car(args); param->type == CONS_TYPE;
+                 param = cdr(param)) {
+                names = cons(car(param), names);
+            }
+        }
+        else if (strcmp(first->s, "let") == 0 ||
+                 strcmp(first->s, "let*") == 0 ||
+                 strcmp(first->s, "letrec") == 0) {
+            for (Value *binding = car(args); binding->type == CONS_TYPE;
+                 binding = cdr(binding)) {
+                if (car(binding)->type == CONS_TYPE) {
+                    names = cons(car(car(binding)), names);
+                }
+            }
+        }
+    }
+    while (expr->type == CONS_TYPE) {
+        names = collectBoundNames(car(expr), names);
+        expr = cdr(expr);
+    }
+    return names;
+}
+
+// Checks whether a symbol with the given name is in a list of symbols
+int nameIn(char *name, Value *names) {
+    for (; names->type == CONS_TYPE; names = cdr(names)) {
+        if (car(names)->type == SYMBOL_TYPE &&
+            strcmp(car(names)->s, name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Checks whether calling a pure primitive on these constant arguments is
+// certain to succeed, so that calling it now can't raise an error the
+// original program wouldn't have raised (or raise it at a different time)
+int canFold(Primitive *primitive, Value *args) {
+    char *name = primitive->name;
+    int count = 0;
+    int numbers = 0;
+    int ints = 0;
+    int strings = 0;
+    for (Value *cur = args; cur->type == CONS_TYPE; cur = cdr(cur)) {
+        Value *arg = constantValue(car(cur));
+        count++;
+        if (arg->type == STR_TYPE) {
+            strings++;
+        }
+        if (arg->type == INT_TYPE || arg->type == DOUBLE_TYPE) {
+            numbers++;
+        }
+        if (arg->type == INT_TYPE) {
+            ints++;
+        }
+    }
+    if (count < primitive->minArgs ||
+        (primitive->maxArgs >= 0 && count > primitive->maxArgs)) {
+        return 0;
+    }
+    if (strcmp(name, "null?") == 0) {
+        return 1;
+    }
+    if (strcmp(name, "car") == 0 || strcmp(name, "cdr") == 0) {
+        return constantValue(car(args))->type == CONS_TYPE;
+    }
+    if (strcmp(name, "symbol->string") == 0) {
+        return constantValue(car(args))->type == SYMBOL_TYPE;
+    }
+    // The pure string primitives only fail on arguments that aren't strings,
+    // except number->string, which is arithmetic below
+    if (strncmp(name, "string", 6) == 0) {
+        return strings == count;
+    }
+    // Everything else is arithmetic on numbers only
+    if (numbers != count) {
+        return 0;
+    }
+    if (strcmp(name, "*") == 0) {
+        // Checks its own count, so the table allows fewer
+        return count >= 2;
+    }
+    if (strcmp(name, "modulo") == 0) {
+        return ints == 2 && constantValue(car(cdr(args)))->i != 0;
+    }
+    if (strcmp(name, "/") == 0) {
+        // Integer division by zero traps
+        return ints != 2 || constantValue(car(cdr(args)))->i != 0;
+    }
+    return 1;
+}
+
+// Calls a pure primitive on constant arguments if that's safe, returning the
+// expression for the result, or NULL if the call has to be left alone
+Value *foldCall(Value *operator, Value *args) {
+    if (operator->type != SYMBOL_TYPE || nameIn(operator->s, boundNames)) {
+        return NULL;
+    }
+    Primitive *primitive = findPrimitive(operator->s);
+    if (primitive == NULL || !primitive->pure) {
+        return NULL;
+    }
+    for (Value *cur = args; cur->type == CONS_TYPE; cur = cdr(cur)) {
+        if (!isConstant(car(cur))) {
+            return NULL;
+        }
+    }
+    if (!canFold(primitive, args)) {
+        return NULL;
+    }
+    int argc = length(args);
+    Value *argv[argc + 1];
+    for (int i = 0; i < argc; i++) {
+        argv[i] = constantValue(car(args));
+        args = cdr(args);
+    }
+    return makeConstant(primitive->function(argc, argv));
+}
+
+// Simplifies (if test then else) when test is a boolean literal
+Value *pruneIf(Value *expr) {
+    Value *args = cdr(expr);
+    if (length(args) != 3) {
+        return expr;
+    }
+    if (isBoolLiteral(car(args), 1)) {
+        return car(cdr(args));
+    }
+    if (isBoolLiteral(car(args), 0)) {
+        return car(cdr(cdr(args)));
+    }
+    return expr;
+}
+
+// Drops literal arguments of and/or that can't change the result. For and,
+// skip is #t and stop is #f; for or it is the other way round. Arguments
+// before a stop literal are kept, since they are still evaluated (and still
+// checked to be booleans) before it.
+Value *pruneAndOr(Value *expr, int skip) {
+    Value *kept = makeNull();
+    int stopped = 0;
+    for (Value *cur = cdr(expr); cur->type == CONS_TYPE; cur = cdr(cur)) {
+        Value *arg = car(cur);
+        if (isBoolLiteral(arg, skip)) {
+            continue;
+        }
+        kept = cons(arg, kept);
+        if (isBoolLiteral(arg, !skip)) {
+            stopped = 1;
+            break;
+        }
+    }
+    if (kept->type == NULL_TYPE) {
+        // (and) is #t and (or) is #f
+        Value *result = talloc(sizeof(Value));
+        result->type = BOOL_TYPE;
+        result->i = skip;
+        return result;
+    }
+    if (stopped && cdr(kept)->type == NULL_TYPE) {
+        return car(kept);
+    }
+    return cons(car(expr), reverse(kept));
+}
+
+// Drops cond clauses whose test is #f, and everything after a clause whose
+// test is #t or else. If the first remaining clause always fires, the whole
+// cond becomes its result expression.
+Value *pruneCond(Value *expr) {
+    Value *kept = makeNull();
+    for (Value *cur = cdr(expr); cur->type == CONS_TYPE; cur = cdr(cur)) {
+        Value *clause = car(cur);
+        if (clause->type != CONS_TYPE || cdr(clause)->type != CONS_TYPE) {
+            return expr;
+        }
+        Value *test = car(clause);
+        if (isBoolLiteral(test, 0)) {
+            continue;
+        }
+        int always = isBoolLiteral(test, 1) ||
+                     (test->type == SYMBOL_TYPE && strcmp(test->s, "else") == 0);
+        if (always && kept->type == NULL_TYPE) {
+            return car(cdr(clause));
+        }
+        kept = cons(clause, kept);
+        if (always) {
+            break;
+        }
+    }
+    return cons(car(expr), reverse(kept));
+}
+
+// Adds every name assigned with set! anywhere in expr to names
+Value *collectAssigned(Value *expr, Value *names) {
+    if (expr->type != CONS_TYPE || isQuoted(expr)) {
+        return names;
+    }
+    if (isForm(expr, "set!") && cdr(expr)->type == CONS_TYPE &&
+        car(cdr(expr))->type == SYMBOL_TYPE) {
+        names = cons(car(cdr(expr)), names);
+    }
+    for (; expr->type == CONS_TYPE; expr = cdr(expr)) {
+        names = collectAssigned(car(expr), names);
+    }
+    return names;
+}
+
+// Adds the names defined anywhere inside a body to locals
+Value *addLocalDefines(Value *body, Value *locals) {
+    if (body->type != CONS_TYPE || isQuoted(body)) {
+        return locals;
+    }
+    if ((isForm(body, "define") || isForm(body, "define-memoized")) &&
+        cdr(body)->type == CONS_TYPE &&
+        car(cdr(body))->type == SYMBOL_TYPE) {
+        locals = cons(car(cdr(body)), locals);
+    }
+    if (isForm(body, "define-record-type")) {
+        locals = recordTypeNames(cdr(body), locals);
+    }
+    for (; body->type == CONS_TYPE; body = cdr(body)) {
+        locals = addLocalDefines(car(body), locals);
+    }
+    return locals;
+}
+
+// Counts how many times a name appears in a list of symbols
+int nameCount(char *name, Value *names) {
+    int count = 0;
+    for (; names->type == CONS_TYPE; names = cdr(names)) {
+        if (car(names)->type == SYMBOL_TYPE &&
+            strcmp(car(names)->s, name) == 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Checks whether expr mentions a symbol with the given name anywhere,
+// including inside quoted data, where it doesn't matter but is harmless
+int mentions(Value *expr, char *name) {
+    if (expr->type == SYMBOL_TYPE) {
+        return strcmp(expr->s, name) == 0;
+    }
+    for (; expr->type == CONS_TYPE; expr = cdr(expr)) {
+        if (mentions(car(expr), name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Checks whether an inlinable body mentions any of the given names
+int mentionsAny(Value *expr, Value *names) {
+    for (; names->type == CONS_TYPE; names = cdr(names)) {
+        if (mentions(expr, car(names)->s)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Counts the atoms in an expression, as a measure of its size
+int exprSize(Value *expr) {
+    if (expr->type != CONS_TYPE) {
+        return 1;
+    }
+    int size = 0;
+    for (; expr->type == CONS_TYPE; expr = cdr(expr)) {
+        size += exprSize(car(expr));
+    }
+    return size;
+}
+
+// Checks whether a lambda body is simple enough to be copied into a call
+// site: no forms that bind or assign variables or make closures, so that
+// nothing in it can capture or be captured by the names around the call site
+int isInlinableBody(Value *body) {
+    if (body->type != CONS_TYPE || isQuoted(body)) {
+        return 1;
+    }
+    if (isForm(body, "lambda") || isForm(body, "let") ||
+        isForm(body, "let*") || isForm(body, "letrec") ||
+        isForm(body, "define") || isForm(body, "define-memoized") ||
+        isForm(body, "define-record-type") || isForm(body, "set!")) {
+        return 0;
+    }
+    for (; body->type == CONS_TYPE; body = cdr(body)) {
+        if (!isInlinableBody(car(body))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Records a top level (define name (lambda params body)) as inlinable if the
+// procedure is small, doesn't call itself, and name is never bound anywhere
+// else in the program or changed with set!
+void noteInlinable(Value *expr) {
+    if (!isForm(expr, "define") || length(expr) != 3) {
+        return;
+    }
+    Value *name = car(cdr(expr));
+    Value *lambda = car(cdr(cdr(expr)));
+    if (name->type != SYMBOL_TYPE || !isForm(lambda, "lambda") ||
+        length(lambda) != 3) {
+        return;
+    }
+    Value *body = car(cdr(cdr(lambda)));
+    if (nameCount(name->s, boundNames) != 1 ||
+        exprSize(body) > INLINE_MAX_SIZE || mentions(body, name->s) ||
+        !isInlinableBody(body)) {
+        return;
+    }
+    for (Value *param = car(cdr(lambda)); param->type == CONS_TYPE;
+         param = cdr(param)) {
+        if (car(param)->type != SYMBOL_TYPE) {
+            return;
+        }
+    }
+    inlinable = cons(cons(name, cons(lambda, makeNull())), inlinable);
+}
+
+// Returns the lambda expression recorded as inlinable under name, or NULL
+Value *findInlinable(char *name) {
+    for (Value *cur = inlinable; cur->type == CONS_TYPE; cur = cdr(cur)) {
+        if (strcmp(car(car(cur))->s, name) == 0) {
+            return car(cdr(car(cur)));
+        }
+    }
+    return NULL;
+}
+
+// Returns a copy of expr with each symbol in params replaced by the matching
+// expression in args. Quoted data is left alone.
+Value *substitute(Value *expr, Value *params, Value *args) {
+    if (expr->type == SYMBOL_TYPE) {
+        for (; params->type == CONS_TYPE; params = cdr(params)) {
+            if (strcmp(car(params)->s, expr->s) == 0) {
+                return car(args);
+            }
+            args = cdr(args);
+        }
+        return expr;
+    }
+    if (expr->type != CONS_TYPE || isQuoted(expr)) {
+        return expr;
+    }
+    Value *result = makeNull();
+    for (; expr->type == CONS_TYPE; expr = cdr(expr)) {
+        result = cons(substitute(car(expr), params, args), result);
+    }
+    return reverse(result);
+}
+
+// Checks whether an argument can be substituted straight into an inlined
+// body: evaluating it later, or more than once, or not at all, must make no
+// difference. That holds for constants, and for local variables that are never
+// assigned, which are always bound and always have the same value.
+int isSubstitutable(Value *arg, Value *locals) {
+    if (isConstant(arg)) {
+        return 1;
+    }
+    return arg->type == SYMBOL_TYPE && nameIn(arg->s, locals) &&
+           !nameIn(arg->s, assignedNames);
+}
+
+// Builds (let ((param arg) ...) body)
+Value *makeLet(Value *params, Value *args, Value *body) {
+    Value *bindings = makeNull();
+    for (; params->type == CONS_TYPE; params = cdr(params)) {
+        bindings = cons(cons(car(params), cons(car(args), makeNull())),
+                        bindings);
+        args = cdr(args);
+    }
+    return cons(makeSymbol("let"),
+                cons(reverse(bindings), cons(body, makeNull())));
+}
+
+// Returns body with params given the values of args, substituting them
+// directly if every argument allows it and binding them with a let otherwise
+Value *bindOrSubstitute(Value *params, Value *args, Value *body,
+                        Value *locals) {
+    if (params->type == NULL_TYPE) {
+        return body;
+    }
+    for (Value *arg = args; arg->type == CONS_TYPE; arg = cdr(arg)) {
+        if (!isSubstitutable(car(arg), locals)) {
+            return makeLet(params, args, body);
+        }
+    }
+    return substitute(body, params, args);
+}
+
+// Replaces a call with the body of the procedure being called, if the call is
+// to an inlinable global procedure or to a lambda expression, returning NULL
+// otherwise. Arguments are substituted into the body when that's safe, and
+// bound with a let when it isn't. Calls with the wrong number of arguments are
+// left alone so they still fail at run time.
+Value *inlineCall(Value *call, Value *locals) {
+    Value *operator = car(call);
+    Value *args = cdr(call);
+
+    // ((lambda (params) body) args) is exactly (let ((param arg) ...) body)
+    if (isForm(operator, "lambda") && length(operator) == 3) {
+        Value *params = car(cdr(operator));
+        Value *body = car(cdr(cdr(operator)));
+        if (length(params) != length(args)) {
+            return NULL;
+        }
+        if (params->type == NULL_TYPE) {
+            // A define in the body would go into the caller's frame instead
+            return addLocalDefines(body, makeNull())->type == NULL_TYPE ?
+                   body : NULL;
+        }
+        if (!isInlinableBody(body)) {
+            return makeLet(params, args, body);
+        }
+        return bindOrSubstitute(params, args, body, locals);
+    }
+
+    if (operator->type != SYMBOL_TYPE || nameIn(operator->s, locals)) {
+        return NULL;
+    }
+    Value *lambda = findInlinable(operator->s);
+    if (lambda == NULL) {
+        return NULL;
+    }
+    Value *params = car(cdr(lambda));
+    Value *body = car(cdr(cdr(lambda)));
+    if (length(params) != length(args)) {
+        return NULL;
+    }
+    // The body's free variables are globals; they must not be shadowed by
+    // local variables at the call site
+    Value *free_names = makeNull();
+    for (Value *local = locals; local->type == CONS_TYPE; local = cdr(local)) {
+        if (!nameIn(car(local)->s, params)) {
+            free_names = cons(car(local), free_names);
+        }
+    }
+    if (mentionsAny(body, free_names)) {
+        return NULL;
+    }
+    return bindOrSubstitute(params, args, body, locals);
+}
+
+// Optimizes every element of a list of expressions
+Value *optimizeEach(Value *exprs, Value *locals) {
+    Value *result = makeNull();
+    while (exprs->type == CONS_TYPE) {
+        result = cons(optimizeExpr(car(exprs), locals), result);
+        exprs = cdr(exprs);
+    }
+    // Keep an improper tail as it was
+    return exprs->type == NULL_TYPE ? reverse(result) : exprs;
+}
+
+// Optimizes the initializers of a let style binding list
+Value *optimizeBindings(Value *bindings, Value *locals) {
+    Value *result = makeNull();
+    for (; bindings->type == CONS_TYPE; bindings = cdr(bindings)) {
+        Value *binding = car(bindings);
+        if (binding->type == CONS_TYPE && cdr(binding)->type == CONS_TYPE) {
+            binding = cons(car(binding),
+                           optimizeEach(cdr(binding), locals));
+        }
+        result = cons(binding, result);
+    }
+    return reverse(result);
+}
+
+// Returns an optimized version of a single expression. locals lists the names
+// that may be bound by an enclosing lambda, let or local define.
+Value *optimizeExpr(Value *expr, Value *locals) {
+    if (expr->type != CONS_TYPE || isQuoted(expr)) {
+        return expr;
+    }
+    Value *first = car(expr);
+    Value *args = cdr(expr);
+    if (first->type == SYMBOL_TYPE && args->type == CONS_TYPE) {
+        char *name = first->s;
+        if (strcmp(name, "quote") == 0 ||
+            strcmp(name, "define-record-type") == 0) {
+            return expr;
+        }
+        if (strcmp(name, "lambda") == 0) {
+            Value *inner = addLocalDefines(cdr(args), locals);
+            for (Value *param = car(args); param->type == CONS_TYPE;
+                 param = cdr(param)) {
+                inner = cons(car(param), inner);
+            }
+            return cons(first, cons(car(args), optimizeEach(cdr(args), inner)));
+        }
+        if (strcmp(name, "define") == 0 || strcmp(name, "define-memoized") == 0 ||
+            strcmp(name, "set!") == 0) {
+            return cons(first, cons(car(args), optimizeEach(cdr(args), locals)));
+        }
+        if (strcmp(name, "let") == 0 || strcmp(name, "let*") == 0 ||
+            strcmp(name, "letrec") == 0) {
+            Value *inner = addLocalDefines(cdr(args), locals);
+            for (Value *binding = car(args); binding->type == CONS_TYPE;
+                 binding = cdr(binding)) {
+                if (car(binding)->type == CONS_TYPE) {
+                    inner = cons(car(car(binding)), inner);
+                }
+            }
+            // let* and letrec initializers can see the new names too
+            Value *outer = strcmp(name, "let") == 0 ? locals : inner;
+            return cons(first, cons(optimizeBindings(car(args), outer),
+                                    optimizeEach(cdr(args), inner)));
+        }
+        if (strcmp(name, "cond") == 0) {
+            Value *clauses = makeNull();
+            for (Value *cur = args; cur->type == CONS_TYPE; cur = cdr(cur)) {
+                Value *clause = car(cur);
+                if (clause->type == CONS_TYPE) {
+                    // The test of an else clause is left as the symbol
+                    Value *test = car(clause);
+                    if (test->type != SYMBOL_TYPE) {
+                        test = optimizeExpr(test, locals);
+                    }
+                    clause = cons(test, optimizeEach(cdr(clause), locals));
+                }
+                clauses = cons(clause, clauses);
+            }
+            return pruneCond(cons(first, reverse(clauses)));
+        }
+    }
+
+    // Special forms that evaluate all their arguments as expressions, and
+    // applications
+    Value *optimized = cons(optimizeExpr(first, locals),
+                            optimizeEach(args, locals));
+    if (first->type == SYMBOL_TYPE) {
+        if (strcmp(first->s, "if") == 0) {
+            return pruneIf(optimized);
+        }
+        if (strcmp(first->s, "and") == 0) {
+            return pruneAndOr(optimized, 1);
+        }
+        if (strcmp(first->s, "or") == 0) {
+            return pruneAndOr(optimized, 0);
+        }
+        if (strcmp(first->s, "begin") == 0) {
+            return optimized;
+        }
+        Value *folded = foldCall(first, cdr(optimized));
+        if (folded != NULL) {
+            return folded;
+        }
+    }
+    Value *inlined = inlineCall(optimized, locals);
+    if (inlined != NULL) {
+        return optimizeExpr(inlined, locals);
+    }
+    return optimized;
+}
+
+// Takes the parse tree of a whole program and returns an optimized version
+// with the same behavior.
+Value *optimize(Value *tree) {
+    boundNames = makeNull();
+    assignedNames = makeNull();
+    inlinable = makeNull();
+    for (Value *cur = tree; cur->type == CONS_TYPE; cur = cdr(cur)) {
+        boundNames = collectBoundNames(car(cur), boundNames);
+        assignedNames = collectAssigned(car(cur), assignedNames);
+    }
+    // Top level forms are done in order, so that a call is only inlined after
+    // the define it refers to has been evaluated
+    Value *result = makeNull();
+    for (Value *cur = tree; cur->type == CONS_TYPE; cur = cdr(cur)) {
+        Value *expr = optimizeExpr(car(cur), makeNull());
+        noteInlinable(expr);
+        result = cons(expr, result);
+    }
+    return reverse(result);
+}
+
+// Prints a program one top level expression per line, in the same notation as
+// printTree uses.
+void printProgram(Value *tree) {
+    for (Value *cur = tree; cur->type == CONS_TYPE; cur = cdr(cur)) {
+        printTree(cons(car(cur), makeNull()));
+        fprintf(outputFile, "\n");
+    }
+}
@@ -0,0 +1,21 @@
+#include "value.h"
+
+#ifndef _OPTIMIZER
+#define _OPTIMIZER
+
+// Takes the parse tree of a whole program and returns an optimized version
+// with the same behavior: calls to pure primitives on constant arguments are
+// evaluated ahead of time, if, cond, and and or with constant tests are cut
+// down to the branches that can run, and calls to small global procedures and
+// to lambda expressions are replaced by the procedure body.
+Value *optimize(Value *tree);
+
+// Returns an optimized version of a single expression. locals lists the names
+// that may be bound by an enclosing lambda, let or local define.
+Value *optimizeExpr(Value *expr, Value *locals);
+
+// Prints a program one top level expression per line, in the same notation as
+// printTree uses.
+void printProgram(Value *tree);
+
+#endif
@@ -6,6 +6,9 @@
 #include "linkedlist.h"
 #include "value.h"
 #include "talloc.h"
+#include "interpreter.h"
+#include "record.h"
+#include "bytevector.h"
 
 // Adds a token to a parse tree
 Value *addToParseTree(Value *tree, int *depth, Value *token) {
@@ -24,11 +27,11 @@ Value *addToParseTree(Value *tree, int *depth, Value *token) {
 // Prints error messages and exits for the two syntax error cases
 void syntaxError(int case_num) {
     if (case_num == 1) {
-        printf("Syntax error: too many close parentheses.\n");
+        fprintf(outputFile, "Syntax error: too many close parentheses.\n");
         texit(1);
     }
     else if (case_num == 2) {
-        printf("Syntax error: not enough close parentheses.\n");
+        fprintf(outputFile, "Syntax error: not enough close parentheses.\n");
         texit(1);
     }
 }
@@ -85,6 +88,15 @@ Value *parse(Value *tokens) {
 }
 
 
+void printBytevector(Value *bytevector) {
+    fprintf(outputFile, "#u8(");
+    for (size_t i = 0; i < bytevector->bytevector->length; i++) {
+        fprintf(outputFile, i == 0 ? "%d" : " %d",
+                bytevector->bytevector->data[i]);
+    }
+    fprintf(outputFile, ")");
+}
+
 // Prints the tree to the screen in a readable fashion. It should look just like
 // Racket code; use parentheses to indicate subtrees.
 void printTree(Value *tree) {
@@ -94,23 +106,33 @@ void printTree(Value *tree) {
             switch (cur_node->type) {
                 case BOOL_TYPE:
                     if ((*cur_node).i == 0) {
-                        printf(". #f");
+                        fprintf(outputFile, ". #f");
                     }
                     else {
-                        printf(". #t");
+                        fprintf(outputFile, ". #t");
                     }
                     break;
                 case INT_TYPE:
-                    printf(". %i", (*cur_node).i);
+                    fprintf(outputFile, ". %i", (*cur_node).i);
                     break;
                 case DOUBLE_TYPE:
-                    printf(". %f", (*cur_node).d);
+                    fprintf(outputFile, ". %f", (*cur_node).d);
                     break;
                 case STR_TYPE:
-                    printf(". \"%s\"", (*cur_node).s);
+                    fprintf(outputFile, ". \"%.*s\"",
+                            (int) (*cur_node).str.length,
+                            (*cur_node).str.chars);
                     break;
                 case SYMBOL_TYPE:
-                    printf(". %s", (*cur_node).s);
+                    fprintf(outputFile, ". %s", (*cur_node).s);
+                    break;
+                case RECORD_TYPE:
+                    fprintf(outputFile, ". #<record %s>",
+                            cur_node->record->type->name);
+                    break;
+                case BYTEVECTOR_TYPE:
+                    fprintf(outputFile, ". ");
+                    printBytevector(cur_node);
                     break;
             }
             break;
@@ -118,13 +140,13 @@ void printTree(Value *tree) {
         
         // If statement to print nested parse trees
         if ((*car(cur_node)).type == CONS_TYPE) {
-            printf("(");
+            fprintf(outputFile, "(");
             printTree(car(cur_node));
-            printf(")");
+            fprintf(outputFile, ")");
         }
         // If statement to print empty lists
         else if ((*car(cur_node)).type == NULL_TYPE) {
-            printf("()");
+            fprintf(outputFile, "()");
         }
         // Two sets of switch statements for printing with or without a space
         else if ((*cdr(cur_node)).type == NULL_TYPE) {
@@ -134,23 +156,31 @@ void printTree(Value *tree) {
             switch (car_type) {
                 case BOOL_TYPE:
                     if ((*car_val).i == 0) {
-                        printf("#f");
+                        fprintf(outputFile, "#f");
                     }
                     else {
-                        printf("#t");
+                        fprintf(outputFile, "#t");
                     }
                     break;
                 case INT_TYPE:
-                    printf("%i", (*car_val).i);
+                    fprintf(outputFile, "%i", (*car_val).i);
                     break;
                 case DOUBLE_TYPE:
-                    printf("%f", (*car_val).d);
+                    fprintf(outputFile, "%f", (*car_val).d);
                     break;
                 case STR_TYPE:
-                    printf("\"%s\"", (*car_val).s);
+                    fprintf(outputFile, "\"%.*s\"", (int) (*car_val).str.length,
+                            (*car_val).str.chars);
                     break;
                 case SYMBOL_TYPE:
-                    printf("%s", (*car_val).s);
+                    fprintf(outputFile, "%s", (*car_val).s);
+                    break;
+                case RECORD_TYPE:
+                    fprintf(outputFile, "#<record %s>",
+                            car_val->record->type->name);
+                    break;
+                case BYTEVECTOR_TYPE:
+                    printBytevector(car_val);
                     break;
             }
         }
@@ -161,23 +191,32 @@ void printTree(Value *tree) {
             switch (car_type) {
                 case BOOL_TYPE:
                     if ((*car_val).i == 0) {
-                        printf("#f ");
+                        fprintf(outputFile, "#f ");
                     }
                     else {
-                        printf("#t ");
+                        fprintf(outputFile, "#t ");
                     }
                     break;
                 case INT_TYPE:
-                    printf("%i ", (*car_val).i);
+                    fprintf(outputFile, "%i ", (*car_val).i);
                     break;
                 case DOUBLE_TYPE:
-                    printf("%f ", (*car_val).d);
+                    fprintf(outputFile, "%f ", (*car_val).d);
                     break;
                 case STR_TYPE:
-                    printf("\"%s\" ", (*car_val).s);
+                    fprintf(outputFile, "\"%.*s\" ", (int) (*car_val).str.length,
+                            (*car_val).str.chars);
                     break;
                 case SYMBOL_TYPE:
-                    printf("%s ", (*car_val).s);
+                    fprintf(outputFile, "%s ", (*car_val).s);
+                    break;
+                case RECORD_TYPE:
+                    fprintf(outputFile, "#<record %s> ",
+                            car_val->record->type->name);
+                    break;
+                case BYTEVECTOR_TYPE:
+                    printBytevector(car_val);
+                    fprintf(outputFile, " ");
                     break;
             }
         }
@@ -12,5 +12,8 @@ Value *parse(Value *tokens);
 // Racket code; use parentheses to indicate subtrees.
 void printTree(Value *tree);
 
+// Prints a bytevector's bytes as #u8(1 2 3)
+void printBytevector(Value *bytevector);
+
 
 #endif
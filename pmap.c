@@ -0,0 +1,262 @@
+/* pmap.c - Persistent hash array mapped tries for use in interpreter project */
+/* By Tore Banta & Charlie Sarano                                            */
+
+#include <string.h>
+#include "value.h"
+#include "talloc.h"
+#include "hashtable.h"
+#include "pmap.h"
+
+// Each level of the trie uses this many bits of the hash. Below the last
+// level that has bits left, keys with the same hash share a collision node,
+// which is just an unordered array of entries.
+#define PMAP_BITS 5
+#define PMAP_MAX_SHIFT 64
+
+// A slot of a node: either a key and its value, or a child node
+typedef struct PmapEntry {
+    Value *key;
+    union {
+        Value *value;
+        struct PmapNode *node;
+    };
+} PmapEntry;
+
+// bitmap has a bit set for each of the 32 slots in use, and nodemap the
+// subset of those that hold child nodes. entries has one element per set bit
+// of bitmap, in slot order. A collision node uses size instead.
+typedef struct PmapNode {
+    unsigned int bitmap;
+    unsigned int nodemap;
+    unsigned int size;
+    PmapEntry entries[];
+} PmapNode;
+
+// Returns the slot the hash picks at the level with this shift
+unsigned int slotAt(unsigned long hash, int shift) {
+    return (hash >> shift) & ((1 << PMAP_BITS) - 1);
+}
+
+// Returns where in entries the given slot's bit is stored
+int entryIndex(unsigned int bitmap, unsigned int bit) {
+    return __builtin_popcount(bitmap & (bit - 1));
+}
+
+// Makes a node with room for size entries
+PmapNode *makeNode(unsigned int bitmap, unsigned int nodemap,
+                   unsigned int size) {
+    PmapNode *node = talloc(sizeof(PmapNode) + sizeof(PmapEntry) * size);
+    node->bitmap = bitmap;
+    node->nodemap = nodemap;
+    node->size = size;
+    return node;
+}
+
+// Returns a copy of node, with one more or one fewer entry when grow is 1 or
+// -1; the entries are copied as they are and the caller fixes them up
+PmapNode *copyNode(PmapNode *node, int grow) {
+    PmapNode *copy = makeNode(node->bitmap, node->nodemap, node->size + grow);
+    memcpy(copy->entries, node->entries,
+           sizeof(PmapEntry) * (grow < 0 ? copy->size : node->size));
+    return copy;
+}
+
+Pmap *makePmap(PmapNode *root, unsigned long count) {
+    Pmap *map = talloc(sizeof(Pmap));
+    map->root = root;
+    map->count = count;
+    return map;
+}
+
+Pmap *pmapEmpty() {
+    return makePmap(makeNode(0, 0, 0), 0);
+}
+
+Value *pmapGet(Pmap *map, Value *key) {
+    unsigned long hash = hashValue(key);
+    PmapNode *node = map->root;
+    for (int shift = 0; shift < PMAP_MAX_SHIFT; shift += PMAP_BITS) {
+        unsigned int bit = 1u << slotAt(hash, shift);
+        if (!(node->bitmap & bit)) {
+            return NULL;
+        }
+        PmapEntry *entry = &node->entries[entryIndex(node->bitmap, bit)];
+        if (!(node->nodemap & bit)) {
+            return valuesEqual(entry->key, key) ? entry->value : NULL;
+        }
+        node = entry->node;
+    }
+    for (unsigned int i = 0; i < node->size; i++) {
+        if (valuesEqual(node->entries[i].key, key)) {
+            return node->entries[i].value;
+        }
+    }
+    return NULL;
+}
+
+// Makes the node holding two entries whose hashes agree on every level above
+// shift, pushing them down until their slots differ
+PmapNode *pairNode(PmapEntry first, unsigned long first_hash,
+                   PmapEntry second, unsigned long second_hash, int shift) {
+    if (shift >= PMAP_MAX_SHIFT) {
+        PmapNode *node = makeNode(0, 0, 2);
+        node->entries[0] = first;
+        node->entries[1] = second;
+        return node;
+    }
+    unsigned int first_slot = slotAt(first_hash, shift);
+    unsigned int second_slot = slotAt(second_hash, shift);
+    if (first_slot == second_slot) {
+        PmapNode *node = makeNode(1u << first_slot, 1u << first_slot, 1);
+        node->entries[0].key = NULL;
+        node->entries[0].node = pairNode(first, first_hash, second,
+                                         second_hash, shift + PMAP_BITS);
+        return node;
+    }
+    PmapNode *node = makeNode((1u << first_slot) | (1u << second_slot), 0, 2);
+    int first_index = first_slot < second_slot ? 0 : 1;
+    node->entries[first_index] = first;
+    node->entries[1 - first_index] = second;
+    return node;
+}
+
+// Returns node with key bound to value, setting *added if key is new
+PmapNode *assocNode(PmapNode *node, Value *key, unsigned long hash,
+                    Value *value, int shift, int *added) {
+    PmapEntry new_entry;
+    new_entry.key = key;
+    new_entry.value = value;
+    if (shift >= PMAP_MAX_SHIFT) {
+        // Collision node
+        for (unsigned int i = 0; i < node->size; i++) {
+            if (valuesEqual(node->entries[i].key, key)) {
+                PmapNode *copy = copyNode(node, 0);
+                copy->entries[i] = new_entry;
+                return copy;
+            }
+        }
+        PmapNode *copy = copyNode(node, 1);
+        copy->entries[node->size] = new_entry;
+        *added = 1;
+        return copy;
+    }
+    unsigned int bit = 1u << slotAt(hash, shift);
+    int index = entryIndex(node->bitmap, bit);
+    if (!(node->bitmap & bit)) {
+        // A free slot: insert the entry, moving the later ones along
+        PmapNode *copy = makeNode(node->bitmap | bit, node->nodemap,
+                                  node->size + 1);
+        memcpy(copy->entries, node->entries, sizeof(PmapEntry) * index);
+        copy->entries[index] = new_entry;
+        memcpy(copy->entries + index + 1, node->entries + index,
+               sizeof(PmapEntry) * (node->size - index));
+        *added = 1;
+        return copy;
+    }
+    PmapNode *copy = copyNode(node, 0);
+    PmapEntry *entry = &copy->entries[index];
+    if (node->nodemap & bit) {
+        entry->node = assocNode(entry->node, key, hash, value,
+                                shift + PMAP_BITS, added);
+    }
+    else if (valuesEqual(entry->key, key)) {
+        entry->value = value;
+    }
+    else {
+        // Two keys in one slot: replace the entry with a child node for both
+        PmapEntry old_entry = *entry;
+        entry->key = NULL;
+        entry->node = pairNode(old_entry, hashValue(old_entry.key), new_entry,
+                               hash, shift + PMAP_BITS);
+        copy->nodemap |= bit;
+        *added = 1;
+    }
+    return copy;
+}
+
+Pmap *pmapAssoc(Pmap *map, Value *key, Value *value) {
+    int added = 0;
+    PmapNode *root = assocNode(map->root, key, hashValue(key), value, 0,
+                               &added);
+    return makePmap(root, map->count + added);
+}
+
+// Returns node without key, or node itself if key isn't there. A node left
+// with a single key and no children is replaced by that key in its parent,
+// so the trie stays as shallow as the keys allow.
+PmapNode *dissocNode(PmapNode *node, Value *key, unsigned long hash,
+                     int shift) {
+    if (shift >= PMAP_MAX_SHIFT) {
+        for (unsigned int i = 0; i < node->size; i++) {
+            if (valuesEqual(node->entries[i].key, key)) {
+                // The last entry takes the place of the removed one
+                PmapNode *copy = copyNode(node, -1);
+                if (i < copy->size) {
+                    copy->entries[i] = node->entries[node->size - 1];
+                }
+                return copy;
+            }
+        }
+        return node;
+    }
+    unsigned int bit = 1u << slotAt(hash, shift);
+    if (!(node->bitmap & bit)) {
+        return node;
+    }
+    int index = entryIndex(node->bitmap, bit);
+    PmapEntry *entry = &node->entries[index];
+    if (node->nodemap & bit) {
+        PmapNode *child = dissocNode(entry->node, key, hash,
+                                     shift + PMAP_BITS);
+        if (child == entry->node) {
+            return node;
+        }
+        PmapNode *copy = copyNode(node, 0);
+        if (child->nodemap == 0 && child->size == 1) {
+            // Pull the child's only entry up into this node
+            copy->entries[index] = child->entries[0];
+            copy->nodemap &= ~bit;
+        }
+        else {
+            copy->entries[index].node = child;
+        }
+        return copy;
+    }
+    if (!valuesEqual(entry->key, key)) {
+        return node;
+    }
+    // Remove the entry, moving the later ones back
+    PmapNode *copy = makeNode(node->bitmap & ~bit, node->nodemap,
+                              node->size - 1);
+    memcpy(copy->entries, node->entries, sizeof(PmapEntry) * index);
+    memcpy(copy->entries + index, node->entries + index + 1,
+           sizeof(PmapEntry) * (node->size - index - 1));
+    return copy;
+}
+
+Pmap *pmapDissoc(Pmap *map, Value *key) {
+    PmapNode *root = dissocNode(map->root, key, hashValue(key), 0);
+    if (root == map->root) {
+        return map;
+    }
+    return makePmap(root, map->count - 1);
+}
+
+// Visits the entries of node and everything below it
+void eachNode(PmapNode *node, int shift,
+              void (*visit)(Value *key, Value *value, void *data), void *data) {
+    for (unsigned int i = 0; i < node->size; i++) {
+        PmapEntry *entry = &node->entries[i];
+        if (shift < PMAP_MAX_SHIFT && entry->key == NULL) {
+            eachNode(entry->node, shift + PMAP_BITS, visit, data);
+        }
+        else {
+            visit(entry->key, entry->value, data);
+        }
+    }
+}
+
+void pmapEach(Pmap *map, void (*visit)(Value *key, Value *value, void *data),
+              void *data) {
+    eachNode(map->root, 0, visit, data);
+}
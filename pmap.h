@@ -0,0 +1,34 @@
+#include "value.h"
+
+#ifndef _PMAP
+#define _PMAP
+
+// Persistent maps: immutable maps from Values to Values, where adding or
+// removing a key makes a new map that shares everything but the changed path
+// with the old one. They are hash array mapped tries: each node covers five
+// bits of the key's hash and stores only the slots in use, found by counting
+// the set bits of a bitmap below the slot's bit. Keys are compared as in
+// HASH_EQUAL hash tables.
+
+typedef struct Pmap {
+    struct PmapNode *root;
+    unsigned long count;
+} Pmap;
+
+// Returns the empty map
+Pmap *pmapEmpty();
+
+// Returns the value stored under key, or NULL if there isn't one
+Value *pmapGet(Pmap *map, Value *key);
+
+// Returns a map like map but with key bound to value
+Pmap *pmapAssoc(Pmap *map, Value *key, Value *value);
+
+// Returns a map like map but without key
+Pmap *pmapDissoc(Pmap *map, Value *key);
+
+// Calls visit on every key and value in the map, in no particular order
+void pmapEach(Pmap *map, void (*visit)(Value *key, Value *value, void *data),
+              void *data);
+
+#endif
@@ -0,0 +1,450 @@
+/* profiler.c - Call and sampling profilers for the interpreter project     */
+/* By Tore Banta & Charlie Sarano                                            */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "profiler.h"
+
+// Everything here is allocated with malloc rather than talloc, so that the
+// profiler's own bookkeeping doesn't show up in the allocation counts it
+// reports, and so the report can still be printed after tfree has run.
+
+// Statistics kept for every distinct lambda expression that gets called
+typedef struct ProfileEntry {
+    Value *code;
+    char *name;
+    unsigned long calls;
+    unsigned long allocs;
+    double total;
+    double self;
+    // Number of calls of this procedure currently on the call stack, so that
+    // recursive calls don't count their time towards the total twice
+    int active;
+} ProfileEntry;
+
+// One record per closure call in progress
+typedef struct ProfileCall {
+    ProfileEntry *entry;
+    double start;
+    double childTime;
+    unsigned long startAllocs;
+    unsigned long childAllocs;
+} ProfileCall;
+
+// Deepest shadow stack the sampler records; calls beyond this still run but
+// are left out of the samples
+#define SHADOW_MAX_DEPTH 4096
+
+// Samples are stored back to back in one buffer, each as a depth followed by
+// that many entries. The buffer is allocated up front because the signal
+// handler can't call malloc; samples that don't fit are counted and dropped.
+#define SAMPLE_BUFFER_SLOTS (1 << 22)
+#define SAMPLE_MAX_DEPTH 512
+
+__thread int profiling = 0;
+int callProfiling = 0;
+int sampleProfiling = 0;
+
+// Open addressing hash table of entries, keyed on the closure body pointer
+ProfileEntry **entries = NULL;
+int entriesSize = 0;
+int entriesUsed = 0;
+
+ProfileCall *calls = NULL;
+int callsSize = 0;
+int callsDepth = 0;
+
+// Shadow stack of the closures currently being applied, read by the sampler
+ProfileEntry **shadowStack = NULL;
+volatile sig_atomic_t shadowDepth = 0;
+
+ProfileEntry **sampleBuffer = NULL;
+volatile size_t sampleUsed = 0;
+volatile unsigned long samplesTaken = 0;
+volatile unsigned long samplesDropped = 0;
+char *samplePath = NULL;
+
+// Current time in seconds from a monotonic clock
+double profileNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Sets up the entries table shared by both profilers
+void profileInit() {
+    if (!profiling) {
+        profiling = 1;
+        entriesSize = 256;
+        entries = calloc(entriesSize, sizeof(ProfileEntry *));
+    }
+}
+
+// Turns on per-procedure profiling and arranges for the report to be printed
+// to stderr when the program exits (normally or through texit).
+void profileStart() {
+    profileInit();
+    callProfiling = 1;
+    callsSize = 256;
+    calls = malloc(sizeof(ProfileCall) * callsSize);
+    atexit(profileReport);
+}
+
+// Hashes a pointer into the entries table
+int profileSlot(Value *code, int size) {
+    unsigned long key = (unsigned long) code;
+    key = (key >> 4) * 2654435761UL;
+    return (int) (key % size);
+}
+
+// Doubles the size of the entries table, rehashing every entry
+void profileGrow() {
+    int old_size = entriesSize;
+    ProfileEntry **old_entries = entries;
+    entriesSize = old_size * 2;
+    entries = calloc(entriesSize, sizeof(ProfileEntry *));
+    for (int i = 0; i < old_size; i++) {
+        if (old_entries[i] != NULL) {
+            int slot = profileSlot(old_entries[i]->code, entriesSize);
+            while (entries[slot] != NULL) {
+                slot = (slot + 1) % entriesSize;
+            }
+            entries[slot] = old_entries[i];
+        }
+    }
+    free(old_entries);
+}
+
+// Finds the entry for a closure body, creating an unnamed one if needed
+ProfileEntry *profileLookup(Value *code) {
+    int slot = profileSlot(code, entriesSize);
+    while (entries[slot] != NULL) {
+        if (entries[slot]->code == code) {
+            return entries[slot];
+        }
+        slot = (slot + 1) % entriesSize;
+    }
+    ProfileEntry *entry = calloc(1, sizeof(ProfileEntry));
+    entry->code = code;
+    entries[slot] = entry;
+    entriesUsed++;
+    if (entriesUsed * 4 > entriesSize * 3) {
+        profileGrow();
+    }
+    return entry;
+}
+
+// Gives closures whose body is code a readable name, normally the symbol they
+// were bound to by define or letrec. The first name given wins.
+void profileName(Value *code, char *name) {
+    ProfileEntry *entry = profileLookup(code);
+    if (entry->name == NULL) {
+        entry->name = strdup(name);
+    }
+}
+
+// Number of anonymous procedures named so far
+int anonymousCount = 0;
+
+// Builds a name like "(lambda (x y)) #2" for a closure that was never bound to
+// a name, numbering them in the order they were first called so that
+// anonymous procedures with the same parameters can still be told apart
+char *profileAnonymousName(Value *params) {
+    size_t size = strlen("(lambda ()) #") + 12;
+    for (Value *cur = params; cur->type == CONS_TYPE; cur = cdr(cur)) {
+        if (car(cur)->type == SYMBOL_TYPE) {
+            size += strlen(car(cur)->s) + 1;
+        }
+    }
+    char *name = malloc(size);
+    strcpy(name, "(lambda (");
+    for (Value *cur = params; cur->type == CONS_TYPE; cur = cdr(cur)) {
+        if (car(cur)->type == SYMBOL_TYPE) {
+            strcat(name, car(cur)->s);
+            if (cdr(cur)->type == CONS_TYPE) {
+                strcat(name, " ");
+            }
+        }
+    }
+    anonymousCount++;
+    sprintf(name + strlen(name), ")) #%i", anonymousCount);
+    return name;
+}
+
+// Called by apply() before evaluating a closure body
+void profileEnter(Value *closure) {
+    ProfileEntry *entry = profileLookup(closure->cl.lambda->functionCode);
+    if (entry->name == NULL) {
+        entry->name = profileAnonymousName(closure->cl.lambda->paramNames);
+    }
+    if (sampleProfiling) {
+        int depth = shadowDepth;
+        if (depth < SHADOW_MAX_DEPTH) {
+            shadowStack[depth] = entry;
+        }
+        // The entry must be in place before the handler can see the new depth
+        atomic_signal_fence(memory_order_release);
+        shadowDepth = depth + 1;
+    }
+    if (!callProfiling) {
+        return;
+    }
+    if (callsDepth == callsSize) {
+        callsSize = callsSize * 2;
+        calls = realloc(calls, sizeof(ProfileCall) * callsSize);
+    }
+    ProfileCall *call = &calls[callsDepth];
+    callsDepth++;
+    call->entry = entry;
+    call->childTime = 0;
+    call->childAllocs = 0;
+    call->startAllocs = tallocCount;
+    entry->calls++;
+    entry->active++;
+    // Read the clock last so the bookkeeping above isn't charged to the call
+    call->start = profileNow();
+}
+
+// Called by apply() after evaluating a closure body
+void profileExit() {
+    if (sampleProfiling) {
+        shadowDepth--;
+    }
+    if (!callProfiling) {
+        return;
+    }
+    double now = profileNow();
+    callsDepth--;
+    ProfileCall *call = &calls[callsDepth];
+    ProfileEntry *entry = call->entry;
+    double elapsed = now - call->start;
+    unsigned long allocs = tallocCount - call->startAllocs;
+
+    entry->active--;
+    if (entry->active == 0) {
+        entry->total += elapsed;
+    }
+    entry->self += elapsed - call->childTime;
+    entry->allocs += allocs - call->childAllocs;
+
+    // Charge the whole call to its caller's children
+    if (callsDepth > 0) {
+        calls[callsDepth - 1].childTime += elapsed;
+        calls[callsDepth - 1].childAllocs += allocs;
+    }
+}
+
+void profileNewStack(ProfileStack *stack) {
+    stack->shadowStack = NULL;
+    stack->shadowDepth = 0;
+    stack->calls = NULL;
+    stack->callsSize = 0;
+    stack->callsDepth = 0;
+    stack->suspended = 0;
+    stack->suspendedAllocs = 0;
+    if (sampleProfiling) {
+        stack->shadowStack = malloc(sizeof(ProfileEntry *) * SHADOW_MAX_DEPTH);
+    }
+    if (callProfiling) {
+        stack->callsSize = 256;
+        stack->calls = malloc(sizeof(ProfileCall) * stack->callsSize);
+    }
+}
+
+void profileSaveStack(ProfileStack *stack) {
+    stack->shadowStack = shadowStack;
+    stack->shadowDepth = shadowDepth;
+    stack->calls = calls;
+    stack->callsSize = callsSize;
+    stack->callsDepth = callsDepth;
+    stack->suspended = profileNow();
+    stack->suspendedAllocs = tallocCount;
+}
+
+void profileRestoreStack(ProfileStack *stack) {
+    // The sampler may run between any two of these, so it must never see a
+    // depth greater than that of the shadow stack in place
+    shadowDepth = 0;
+    atomic_signal_fence(memory_order_release);
+    shadowStack = stack->shadowStack;
+    atomic_signal_fence(memory_order_release);
+    shadowDepth = stack->shadowDepth;
+    calls = stack->calls;
+    callsSize = stack->callsSize;
+    callsDepth = stack->callsDepth;
+    // Move the calls in progress on past the time spent switched out
+    double away = profileNow() - stack->suspended;
+    unsigned long away_allocs = tallocCount - stack->suspendedAllocs;
+    for (int i = 0; i < callsDepth; i++) {
+        calls[i].start += away;
+        calls[i].startAllocs += away_allocs;
+    }
+}
+
+void profileFreeStack(ProfileStack *stack) {
+    free(stack->shadowStack);
+    free(stack->calls);
+}
+
+// Orders entries by decreasing self time for the report
+int profileCompare(const void *a, const void *b) {
+    ProfileEntry *entry_a = *(ProfileEntry **) a;
+    ProfileEntry *entry_b = *(ProfileEntry **) b;
+    if (entry_a->self < entry_b->self) {
+        return 1;
+    }
+    else if (entry_a->self > entry_b->self) {
+        return -1;
+    }
+    return 0;
+}
+
+// Prints a table of every profiled procedure, sorted by self time.
+void profileReport() {
+    if (!callProfiling) {
+        return;
+    }
+    ProfileEntry **sorted = malloc(sizeof(ProfileEntry *) * (entriesUsed + 1));
+    int count = 0;
+    for (int i = 0; i < entriesSize; i++) {
+        if (entries[i] != NULL && entries[i]->calls > 0) {
+            sorted[count] = entries[i];
+            count++;
+        }
+    }
+    qsort(sorted, count, sizeof(ProfileEntry *), profileCompare);
+
+    fprintf(stderr, "%12s %12s %12s %12s  %s\n",
+            "calls", "total ms", "self ms", "allocs", "procedure");
+    for (int i = 0; i < count; i++) {
+        fprintf(stderr, "%12lu %12.3f %12.3f %12lu  %s\n",
+                sorted[i]->calls, sorted[i]->total * 1000,
+                sorted[i]->self * 1000, sorted[i]->allocs, sorted[i]->name);
+    }
+    fprintf(stderr, "%12s %12s %12s %12lu  (all allocations)\n",
+            "", "", "", tallocCount);
+    free(sorted);
+}
+
+// SIGPROF handler: copies the current shadow stack into the sample buffer.
+// Only touches memory that was allocated before the timer was started.
+void sampleHandler(int signal) {
+    int depth = shadowDepth;
+    atomic_signal_fence(memory_order_acquire);
+    if (depth > SHADOW_MAX_DEPTH) {
+        depth = SHADOW_MAX_DEPTH;
+    }
+    if (depth > SAMPLE_MAX_DEPTH) {
+        depth = SAMPLE_MAX_DEPTH;
+    }
+    samplesTaken++;
+    if (sampleUsed + depth + 1 > SAMPLE_BUFFER_SLOTS) {
+        samplesDropped++;
+        return;
+    }
+    size_t used = sampleUsed;
+    sampleBuffer[used] = (ProfileEntry *) (intptr_t) depth;
+    for (int i = 0; i < depth; i++) {
+        sampleBuffer[used + 1 + i] = shadowStack[i];
+    }
+    sampleUsed = used + depth + 1;
+}
+
+// Turns on the sampling profiler: every 1/hz seconds of CPU time the shadow
+// stack of active procedures is recorded, and at exit the samples are written
+// to path as folded stacks ("toplevel;f;g 12"), one line per distinct stack,
+// ready for flamegraph.pl or any tool reading the same format.
+void sampleStart(char *path, int hz) {
+    profileInit();
+    sampleProfiling = 1;
+    samplePath = path;
+    shadowStack = malloc(sizeof(ProfileEntry *) * SHADOW_MAX_DEPTH);
+    sampleBuffer = malloc(sizeof(ProfileEntry *) * SAMPLE_BUFFER_SLOTS);
+    atexit(sampleReport);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sampleHandler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / hz;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+// Orders folded stack strings so identical stacks end up next to each other
+int sampleCompare(const void *a, const void *b) {
+    return strcmp(*(char **) a, *(char **) b);
+}
+
+// Stops the sampler and writes the folded stacks file.
+void sampleReport() {
+    if (!sampleProfiling) {
+        return;
+    }
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sampleProfiling = 0;
+
+    // Turn every sample into its folded stack string
+    size_t count = 0;
+    for (size_t i = 0; i < sampleUsed; i += (intptr_t) sampleBuffer[i] + 1) {
+        count++;
+    }
+    char **stacks = malloc(sizeof(char *) * (count + 1));
+    size_t index = 0;
+    for (size_t i = 0; i < sampleUsed; i += (intptr_t) sampleBuffer[i] + 1) {
+        int depth = (intptr_t) sampleBuffer[i];
+        size_t size = strlen("toplevel") + 1;
+        for (int j = 0; j < depth; j++) {
+            size += strlen(sampleBuffer[i + 1 + j]->name) + 1;
+        }
+        char *stack = malloc(size);
+        strcpy(stack, "toplevel");
+        for (int j = 0; j < depth; j++) {
+            strcat(stack, ";");
+            strcat(stack, sampleBuffer[i + 1 + j]->name);
+        }
+        stacks[index] = stack;
+        index++;
+    }
+    qsort(stacks, count, sizeof(char *), sampleCompare);
+
+    FILE *out = fopen(samplePath, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Could not open %s for writing samples\n", samplePath);
+        return;
+    }
+    size_t i = 0;
+    while (i < count) {
+        size_t j = i;
+        while (j < count && strcmp(stacks[i], stacks[j]) == 0) {
+            j++;
+        }
+        fprintf(out, "%s %zu\n", stacks[i], j - i);
+        i = j;
+    }
+    fclose(out);
+    for (i = 0; i < count; i++) {
+        free(stacks[i]);
+    }
+    free(stacks);
+    if (samplesDropped > 0) {
+        fprintf(stderr, "Sampler: %lu of %lu samples dropped, buffer full\n",
+                samplesDropped, samplesTaken);
+    }
+}
@@ -0,0 +1,62 @@
+#include "value.h"
+
+#ifndef _PROFILER
+#define _PROFILER
+
+// Nonzero once either profiler has been started. apply() checks this before
+// doing any profiling work, so the instrumentation costs a single branch
+// when profiling is off. It is per thread: only the main thread is
+// profiled, and calls made inside futures are not counted.
+extern __thread int profiling;
+
+// Turns on per-procedure profiling and arranges for the report to be printed
+// to stderr when the program exits (normally or through texit).
+void profileStart();
+
+// Gives closures whose body is code a readable name, normally the symbol they
+// were bound to by define or letrec. The first name given wins.
+void profileName(Value *code, char *name);
+
+// Called by apply() around the evaluation of a closure body, to record the
+// call count, time and allocations of that closure and to maintain the shadow
+// stack the sampler reads.
+void profileEnter(Value *closure);
+void profileExit();
+
+// Prints a table of every profiled procedure, sorted by self time.
+void profileReport();
+
+// The calls in progress on one stack, kept for each green task while it isn't
+// running, since tasks don't return in the reverse of the order they were
+// entered. The time and allocations made while a task is switched out aren't
+// charged to the calls it has in progress.
+typedef struct ProfileStack {
+    struct ProfileEntry **shadowStack;
+    int shadowDepth;
+    struct ProfileCall *calls;
+    int callsSize;
+    int callsDepth;
+    double suspended;
+    unsigned long suspendedAllocs;
+} ProfileStack;
+
+// Sets up stack as an empty stack for a new task
+void profileNewStack(ProfileStack *stack);
+
+// Saves the calls in progress into stack, or makes those saved in stack the
+// ones in progress
+void profileSaveStack(ProfileStack *stack);
+void profileRestoreStack(ProfileStack *stack);
+
+// Frees a stack made by profileNewStack
+void profileFreeStack(ProfileStack *stack);
+
+// Turns on the sampling profiler: hz times per second of CPU time, a SIGPROF
+// handler records the stack of active procedures, and at exit the samples are
+// written to path in the folded stack format used by flame graph tools.
+void sampleStart(char *path, int hz);
+
+// Stops the sampler and writes the folded stacks file.
+void sampleReport();
+
+#endif
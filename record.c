@@ -0,0 +1,208 @@
+/* record.c - Record types with fields in fixed slots                        */
+/* By Tore Banta & Charlie Sarano                                            */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "record.h"
+
+Value *makeRecord(struct RecordType *type) {
+    // The record and its slots follow the Value in the same block
+    Value *value = talloc(sizeof(Value) + sizeof(struct Record) +
+                          type->fieldCount * sizeof(Value *));
+    value->type = RECORD_TYPE;
+    value->record = (struct Record *) (value + 1);
+    value->record->type = type;
+    return value;
+}
+
+// Returns the slot of the field with the given name, given the field specs of
+// a define-record-type form, or -1 if none
+int fieldSlot(Value *fields, char *name) {
+    int slot = 0;
+    for (Value *field = fields; field->type == CONS_TYPE; field = cdr(field)) {
+        if (strcmp(car(car(field))->s, name) == 0) {
+            return slot;
+        }
+        slot++;
+    }
+    return -1;
+}
+
+// Adds a binding of name to a new record procedure to bindings
+Value *addRecordProcedure(Value *bindings, Value *name,
+                          RecordProcedureKind kind, struct RecordType *type,
+                          int slot) {
+    if (name->type != SYMBOL_TYPE) {
+        evaluationError(18);
+    }
+    struct RecordProcedure *procedure = talloc(sizeof(struct RecordProcedure));
+    procedure->kind = kind;
+    procedure->type = type;
+    procedure->slot = slot;
+    procedure->argc = kind == RECORD_MODIFIER ? 2 : 1;
+    procedure->argSlots = NULL;
+    Value *value = talloc(sizeof(Value));
+    value->type = RECORD_PROC_TYPE;
+    value->recordProc = procedure;
+    return cons(cons(name, cons(value, makeNull())), bindings);
+}
+
+void freeRecordType(Shared *shared) {
+    free(shared);
+}
+
+Value *recordTypeProcedures(Value *args) {
+    if (args->type != CONS_TYPE || car(args)->type != SYMBOL_TYPE ||
+        cdr(args)->type != CONS_TYPE || cdr(cdr(args))->type != CONS_TYPE) {
+        evaluationError(18);
+    }
+    Value *constructor = car(cdr(args));
+    Value *predicate = car(cdr(cdr(args)));
+    Value *fields = cdr(cdr(cdr(args)));
+    if (constructor->type != CONS_TYPE) {
+        evaluationError(18);
+    }
+
+    int field_count = 0;
+    for (Value *field = fields; field->type == CONS_TYPE; field = cdr(field)) {
+        Value *spec = car(field);
+        if (spec->type != CONS_TYPE || car(spec)->type != SYMBOL_TYPE ||
+            length(spec) > 3) {
+            evaluationError(18);
+        }
+        // Each field name only once
+        if (fieldSlot(fields, car(spec)->s) != field_count) {
+            evaluationError(18);
+        }
+        field_count++;
+    }
+    char *name = car(args)->s;
+    struct RecordType *type = malloc(sizeof(struct RecordType) +
+                                     strlen(name) + 1);
+    if (type == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        texit(1);
+    }
+    type->shared.refs = 0;
+    type->shared.free = freeRecordType;
+    type->fieldCount = field_count;
+    strcpy(type->name, name);
+    tshare(&type->shared);
+
+    Value *bindings = makeNull();
+    bindings = addRecordProcedure(bindings, car(constructor),
+                                  RECORD_CONSTRUCTOR, type, 0);
+    struct RecordProcedure *make = car(cdr(car(bindings)))->recordProc;
+    make->argc = length(cdr(constructor));
+    make->argSlots = talloc(make->argc * sizeof(int));
+    int i = 0;
+    for (Value *arg = cdr(constructor); arg->type == CONS_TYPE;
+         arg = cdr(arg)) {
+        if (car(arg)->type != SYMBOL_TYPE) {
+            evaluationError(18);
+        }
+        make->argSlots[i] = fieldSlot(fields, car(arg)->s);
+        if (make->argSlots[i] < 0) {
+            evaluationError(18);
+        }
+        // Each field at most once, so that every slot not named is void
+        for (int j = 0; j < i; j++) {
+            if (make->argSlots[j] == make->argSlots[i]) {
+                evaluationError(18);
+            }
+        }
+        i++;
+    }
+    bindings = addRecordProcedure(bindings, predicate, RECORD_PREDICATE,
+                                  type, 0);
+    int slot = 0;
+    for (Value *field = fields; field->type == CONS_TYPE; field = cdr(field)) {
+        Value *spec = cdr(car(field));
+        if (spec->type == CONS_TYPE) {
+            bindings = addRecordProcedure(bindings, car(spec), RECORD_ACCESSOR,
+                                          type, slot);
+            spec = cdr(spec);
+        }
+        if (spec->type == CONS_TYPE) {
+            bindings = addRecordProcedure(bindings, car(spec), RECORD_MODIFIER,
+                                          type, slot);
+        }
+        slot++;
+    }
+    return reverse(bindings);
+}
+
+Value *recordTypeNames(Value *args, Value *names) {
+    if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE) {
+        return names;
+    }
+    Value *constructor = car(cdr(args));
+    if (constructor->type == CONS_TYPE &&
+        car(constructor)->type == SYMBOL_TYPE) {
+        names = cons(car(constructor), names);
+    }
+    Value *rest = cdr(cdr(args));
+    if (rest->type != CONS_TYPE) {
+        return names;
+    }
+    if (car(rest)->type == SYMBOL_TYPE) {
+        names = cons(car(rest), names);
+    }
+    for (Value *field = cdr(rest); field->type == CONS_TYPE;
+         field = cdr(field)) {
+        if (car(field)->type != CONS_TYPE) {
+            continue;
+        }
+        for (Value *name = cdr(car(field)); name->type == CONS_TYPE;
+             name = cdr(name)) {
+            if (car(name)->type == SYMBOL_TYPE) {
+                names = cons(car(name), names);
+            }
+        }
+    }
+    return names;
+}
+
+Value *applyRecordProcedure(struct RecordProcedure *procedure, int argc,
+                            Value **argv) {
+    if (argc != procedure->argc) {
+        evaluationError(10);
+    }
+    if (procedure->kind == RECORD_CONSTRUCTOR) {
+        Value *record = makeRecord(procedure->type);
+        if (argc < procedure->type->fieldCount) {
+            Value *void_val = talloc(sizeof(Value));
+            void_val->type = VOID_TYPE;
+            for (int i = 0; i < procedure->type->fieldCount; i++) {
+                record->record->slots[i] = void_val;
+            }
+        }
+        for (int i = 0; i < argc; i++) {
+            record->record->slots[procedure->argSlots[i]] = argv[i];
+        }
+        return record;
+    }
+    int matches = argv[0]->type == RECORD_TYPE &&
+                  argv[0]->record->type == procedure->type;
+    if (procedure->kind == RECORD_PREDICATE) {
+        Value *result = talloc(sizeof(Value));
+        result->type = BOOL_TYPE;
+        result->i = matches;
+        return result;
+    }
+    if (!matches) {
+        evaluationError(10);
+    }
+    if (procedure->kind == RECORD_ACCESSOR) {
+        return argv[0]->record->slots[procedure->slot];
+    }
+    argv[0]->record->slots[procedure->slot] = argv[1];
+    Value *void_val = talloc(sizeof(Value));
+    void_val->type = VOID_TYPE;
+    return void_val;
+}
@@ -0,0 +1,68 @@
+#include "value.h"
+#include "talloc.h"
+
+#ifndef _RECORD
+#define _RECORD
+
+// Records: (define-record-type name (constructor field ...) predicate
+// (field accessor [modifier]) ...) defines procedures for a new type of
+// record with the fields listed, each in a slot of its own. The constructor
+// makes a record from values for the fields it names, leaving any others
+// void; the predicate checks whether a value is a record of the type; each
+// accessor returns a field of a record of the type, and each modifier sets
+// one. The type name is only used when printing records.
+//
+// A record is a single allocation: its Value, then its type and slots. The
+// procedures defined are Values of their own type rather than closures, and
+// apply() runs them directly, so reading a field is a type check and a load
+// from a fixed offset.
+//
+// Like a closure, a record can be sent to an actor, and the copy is a record
+// of the same type.
+
+// A type of record, made by a define-record-type form. Records and record
+// procedures copied to actors go on referring to the type they were made
+// with, so that they still work with each other, so it isn't talloc'd; it is
+// freed once every heap holding something of the type has been.
+struct RecordType {
+    Shared shared;
+    int fieldCount;
+    char name[];
+};
+
+struct Record {
+    struct RecordType *type;
+    Value *slots[];
+};
+
+typedef enum {RECORD_CONSTRUCTOR, RECORD_PREDICATE, RECORD_ACCESSOR,
+              RECORD_MODIFIER} RecordProcedureKind;
+
+// A procedure defined by define-record-type. An accessor or modifier works on
+// the field in slot; a constructor takes argc arguments, which go in the
+// slots listed in argSlots.
+struct RecordProcedure {
+    RecordProcedureKind kind;
+    struct RecordType *type;
+    int slot;
+    int argc;
+    int *argSlots;
+};
+
+// Makes a record of the given type, whose slots the caller must fill
+Value *makeRecord(struct RecordType *type);
+
+// Returns bindings for the procedures a define-record-type form defines, given
+// everything after define-record-type, each a list of the name and procedure
+// ready to add to a frame
+Value *recordTypeProcedures(Value *args);
+
+// Adds the names a define-record-type form defines to names, given everything
+// after define-record-type. Parts of the form that are malformed are skipped,
+// and reported when the form is evaluated.
+Value *recordTypeNames(Value *args, Value *names);
+
+Value *applyRecordProcedure(struct RecordProcedure *procedure, int argc,
+                            Value **argv);
+
+#endif
@@ -0,0 +1,50 @@
+#include <stdio.h>
+
+#ifndef _SCHEME
+#define _SCHEME
+
+// The interface for programs embedding the interpreter, built as libscheme.a
+// (link with -lpthread as well). Each Interp has its own heap and global
+// environment, so definitions made by one call to interp_eval_string are
+// visible to later calls on the same Interp but not to other Interps.
+// Different Interps may be used on different threads at once; one Interp
+// must only be used by one thread at a time.
+//
+// Errors in the code evaluated are reported on the Interp's output, as the
+// command line interpreter does, and make interp_eval_string return -1
+// rather than ending the process. That includes an error inside a future,
+// wherever it runs, which is reported when it happens, on the output of the
+// Interp that made the future, and makes touching the future an error.
+//
+// Code evaluated with interp_eval_string is not optimized, since the optimizer
+// assumes it sees the whole program at once.
+
+typedef struct Interp Interp;
+
+// Returns a new interpreter with only the primitives defined, printing to
+// stdout, or NULL if there is no memory for it
+Interp *interp_new();
+
+// Sets where the values of top level expressions and error messages go,
+// along with the output of actors spawned in the Interp, which may go on
+// after it is freed
+void interp_set_output(Interp *interp, FILE *output);
+
+// Evaluates every expression in source, printing their values. Returns 0, or
+// -1 if there was a syntax or evaluation error, in which case the
+// expressions after the failing one are not evaluated.
+int interp_eval_string(Interp *interp, const char *source);
+
+// Evaluates a whole program read from input, as the command line interpreter
+// does: unlike interp_eval_string, the program is optimized first, so it must
+// not redefine anything defined by code evaluated in the Interp before.
+// Returns 0 or -1 as interp_eval_string does.
+int interp_eval_program(Interp *interp, FILE *input);
+
+// Frees the interpreter and everything allocated while evaluating in it,
+// unmapping the files it mapped unless actors still have them.
+// What futures allocate is kept by the worker threads that ran them until
+// the last Interp is freed.
+void interp_free(Interp *interp);
+
+#endif
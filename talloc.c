@@ -3,97 +3,575 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <sys/resource.h>
+#include <pthread.h>
 #include "value.h"
+#include "talloc.h"
 
-// Uninitialized pointers to front and back of list of talloc'd pointers
-Value *pointers = NULL;
-Value *pointers_copy;
-
-// Create a new CONS_TYPE value node.
-Value *cons_cell(Value *car, Value *cdr) {
-    Value *cons_node = malloc(sizeof(Value));
-    (*cons_node).type = CONS_TYPE;
-    struct ConsCell cons_cell;
-    cons_cell.car = car;
-    cons_cell.cdr = cdr;
-    (*cons_node).c = cons_cell;
-    
-    return cons_node;
-}
-
-// Replacement for malloc that stores the pointers allocated. It should store
-// the pointers in some kind of list; a linked list would do fine, but insert
-// here whatever code you'll need to do so; don't call functions in the
-// pre-existing linkedlist.h. Otherwise you'll end up with circular
-// dependencies, since you're going to modify the linked list to use talloc.
-void *talloc(size_t size) {
-    if (pointers == NULL) {
-        // If pointers list uninitialized, initializes...
-        pointers = malloc(sizeof(Value));
-        // Copy points to back of linked list for purpose of freeing later
-        pointers_copy = pointers;
-        
-        (*pointers).type = CONS_TYPE;
-        
-        Value *null_val = malloc(sizeof(Value));
-        (*null_val).type = NULL_TYPE;
-        
-        // Value created to store pointer member p
-        Value *ptr_storage = malloc(sizeof(Value));
-        void *ptr = malloc(size);
-        (*ptr_storage).p = ptr;
-        
-        // Cons with null Value node to start list
-        pointers = cons_cell(ptr_storage, null_val);
-        
-        return ptr;
+// Each thread allocates by bumping a pointer through its own buffer, a chunk
+// of memory from a pool shared by all threads. When the buffer is full the
+// thread moves on to another chunk: one of its own spares, else the whole of
+// the shared free list, taken with a single atomic exchange, else a new one
+// from malloc. Chunks are handed back to the pool when trelease frees them.
+// The shared free list is only ever pushed onto or taken entire, so it needs
+// no lock and can't suffer from ABA. Blocks bigger than a chunk get a chunk
+// of their own, which goes straight back to malloc.
+#define CHUNK_SIZE (256 * 1024)
+#define LOCAL_SPARES 4
+
+// A reference to a Shared block, made by tshare in the heap
+typedef struct SharedRef {
+    Shared *shared;
+    struct SharedRef *next;
+} SharedRef;
+
+// refs lists the references to Shared blocks made in the chunk, newest first,
+// to be dropped when the chunk is freed or released past them
+typedef struct Chunk {
+    struct Chunk *prev;
+    size_t size;
+    size_t used;
+    int large;
+    SharedRef *refs;
+    char data[] __attribute__((aligned(16)));
+} Chunk;
+
+// Every talloc'd block is preceded by a header giving the space it takes up,
+// so release can walk a chunk's blocks, and the size asked for and site it
+// is counted against. The header is 16 bytes, which keeps the block itself
+// 16-byte aligned.
+typedef struct BlockHeader {
+    unsigned int space;
+    unsigned int size;
+    unsigned short site;
+    unsigned short padding[3];
+} BlockHeader;
+
+// Per site statistics, only kept once tallocStatsStart has been called. A site
+// is a function name and object kind; names are compared by pointer, since
+// each comes from the __func__ of the function that called talloc.
+#define MAX_SITES 1024
+
+typedef struct AllocSite {
+    const char *name;
+    allocKind kind;
+    unsigned long count;
+    unsigned long bytes;
+    unsigned long live;
+    unsigned long peak;
+} AllocSite;
+
+// Everything talloc keeps for one thread: the chunk its buffer is in, whose
+// prev links lead back through the older chunks of its heap, its spare
+// chunks, and its statistics, kept per thread so counting needs no lock.
+typedef struct ThreadHeap {
+    Chunk *chunk;
+    Chunk *spares;
+    int spareCount;
+    AllocSite sites[MAX_SITES];
+    int sitesUsed; // Site 0 collects anything past MAX_SITES
+    unsigned long liveBytes;
+    unsigned long peakLiveBytes;
+} ThreadHeap;
+
+__thread ThreadHeap heap = {.sitesUsed = 1};
+
+// Running totals of allocations made through talloc by this thread
+__thread unsigned long tallocCount = 0;
+__thread unsigned long tallocBytes = 0;
+
+// Chunks no thread is using
+Chunk *freeChunks = NULL;
+
+// The heaps of the threads that have registered, for tfree to free and for
+// the statistics report
+#define MAX_THREADS 256
+
+ThreadHeap *threadHeaps[MAX_THREADS];
+int threadHeapCount = 0;
+
+// The statistics of threads that have finished
+ThreadHeap finishedThreads = {.sitesUsed = 1};
+int threadsStarted = 0;
+pthread_mutex_t tallocLock = PTHREAD_MUTEX_INITIALIZER;
+
+int allocStats = 0;
+
+char *kindNames[] = {"value", "cons", "frame", "buffer"};
+
+// Finds the index of a site in a sites table, adding it if it is new
+unsigned short siteIndex(AllocSite *sites, int *used, const char *name,
+                         allocKind kind) {
+    unsigned long hash = ((unsigned long) name >> 3) * 31 + kind;
+    int slot = hash % (MAX_SITES - 1) + 1;
+    for (int probes = 1; probes < MAX_SITES; probes++) {
+        if (sites[slot].name == name && sites[slot].kind == kind) {
+            return slot;
+        }
+        if (sites[slot].name == NULL) {
+            sites[slot].name = name;
+            sites[slot].kind = kind;
+            (*used)++;
+            return slot;
+        }
+        slot = slot % (MAX_SITES - 1) + 1;
+    }
+    return 0;
+}
+
+// Returns an empty chunk with room for size bytes. An ordinary chunk comes
+// from the calling thread's spares or the shared pool if there are any.
+Chunk *takeChunk(size_t size) {
+    Chunk *chunk = NULL;
+    if (size <= CHUNK_SIZE) {
+        if (heap.spares == NULL) {
+            heap.spares = __atomic_exchange_n(&freeChunks, NULL,
+                                              __ATOMIC_ACQUIRE);
+            heap.spareCount = 0;
+            for (Chunk *spare = heap.spares; spare != NULL;
+                 spare = spare->prev) {
+                heap.spareCount++;
+            }
+        }
+        if (heap.spares != NULL) {
+            chunk = heap.spares;
+            heap.spares = chunk->prev;
+            heap.spareCount--;
+        }
+        size = CHUNK_SIZE;
+    }
+    if (chunk == NULL) {
+        chunk = malloc(sizeof(Chunk) + size);
+        if (chunk == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            texit(1);
+        }
+        chunk->size = size;
+        chunk->large = size > CHUNK_SIZE;
+    }
+    chunk->used = 0;
+    chunk->refs = NULL;
+    return chunk;
+}
+
+// Adds a chunk to the shared free list
+void shareChunk(Chunk *chunk) {
+    chunk->prev = __atomic_load_n(&freeChunks, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&freeChunks, &chunk->prev, chunk, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Gives back a chunk the calling thread has finished with
+void giveChunk(Chunk *chunk) {
+    if (chunk->large) {
+        free(chunk);
+    }
+    else if (heap.spareCount < LOCAL_SPARES) {
+        chunk->prev = heap.spares;
+        heap.spares = chunk;
+        heap.spareCount++;
+    }
+    else {
+        shareChunk(chunk);
+    }
+}
+
+// Replacement for malloc that carves blocks out of the calling thread's
+// buffer, so that they can be freed all together later.
+void *tallocSite(size_t size, allocKind kind, const char *site) {
+    tallocCount++;
+    tallocBytes += size;
+
+    size_t space = sizeof(BlockHeader) + ((size + 15) & ~(size_t) 15);
+    Chunk *chunk = heap.chunk;
+    if (chunk == NULL || chunk->used + space > chunk->size) {
+        chunk = takeChunk(space);
+        chunk->prev = heap.chunk;
+        heap.chunk = chunk;
+    }
+    BlockHeader *header = (BlockHeader *) (chunk->data + chunk->used);
+    chunk->used += space;
+    header->space = space;
+
+    if (allocStats) {
+        unsigned short index = siteIndex(heap.sites, &heap.sitesUsed, site,
+                                         kind);
+        AllocSite *counted = &heap.sites[index];
+        header->site = index;
+        header->size = size;
+        counted->count++;
+        counted->bytes += size;
+        counted->live += size;
+        if (counted->live > counted->peak) {
+            counted->peak = counted->live;
+        }
+        heap.liveBytes += size;
+        if (heap.liveBytes > heap.peakLiveBytes) {
+            heap.peakLiveBytes = heap.liveBytes;
+        }
     }
     else {
-        // Otherwise, just creates pointer storage Value node to cons with list
-        Value *ptr_storage = malloc(sizeof(Value));
-        void *ptr = malloc(size);
-        struct ConsCell pointer_cell;
-        (*ptr_storage).type = PTR_TYPE;
-        (*ptr_storage).p = ptr;
-        
-        pointers = cons_cell(ptr_storage, pointers);
+        header->site = 0;
+        header->size = 0;
+    }
+
+    return header + 1;
+}
+
+// Adds the calling thread's heap to those tfree and the report know about
+void registerHeap() {
+    pthread_mutex_lock(&tallocLock);
+    int known = 0;
+    for (int i = 0; i < threadHeapCount; i++) {
+        known = known || threadHeaps[i] == &heap;
+    }
+    if (!known && threadHeapCount < MAX_THREADS) {
+        threadHeaps[threadHeapCount++] = &heap;
+    }
+    pthread_mutex_unlock(&tallocLock);
+}
+
+// Turns on per site allocation statistics and arranges for the report to be
+// printed at exit.
+void tallocStatsStart() {
+    allocStats = 1;
+    registerHeap();
+    atexit(tallocReport);
+}
+
+// Orders sites by decreasing bytes allocated
+int siteCompare(const void *a, const void *b) {
+    AllocSite *site_a = *(AllocSite **) a;
+    AllocSite *site_b = *(AllocSite **) b;
+    if (site_a->bytes < site_b->bytes) {
+        return 1;
+    }
+    else if (site_a->bytes > site_b->bytes) {
+        return -1;
+    }
+    return 0;
+}
+
+// Adds the statistics of one thread's heap to those of another
+void addHeapStats(ThreadHeap *sum, ThreadHeap *thread) {
+    for (int i = 0; i < MAX_SITES; i++) {
+        AllocSite *site = &thread->sites[i];
+        if (site->count == 0) {
+            continue;
+        }
+        int index = i == 0 ? 0 : siteIndex(sum->sites, &sum->sitesUsed,
+                                           site->name, site->kind);
+        sum->sites[index].count += site->count;
+        sum->sites[index].bytes += site->bytes;
+        sum->sites[index].live += site->live;
+        sum->sites[index].peak += site->peak;
+    }
+    sum->liveBytes += thread->liveBytes;
+    sum->peakLiveBytes += thread->peakLiveBytes;
+}
+
+// Prints the allocation statistics report, with each site's figures summed
+// over all threads. The threads' peaks may not have coincided, so the total
+// peak is an upper bound.
+void tallocReport() {
+    if (!allocStats) {
+        return;
+    }
+    ThreadHeap *sum = calloc(1, sizeof(ThreadHeap));
+    sum->sitesUsed = 1;
+    pthread_mutex_lock(&tallocLock);
+    for (int t = 0; t < threadHeapCount; t++) {
+        addHeapStats(sum, threadHeaps[t]);
+    }
+    addHeapStats(sum, &finishedThreads);
+    pthread_mutex_unlock(&tallocLock);
+    AllocSite *totals = sum->sites;
+    totals[0].name = "(other)";
+    totals[0].kind = ALLOC_BUFFER;
+    unsigned long count = 0;
+    unsigned long bytes = 0;
+    for (int i = 0; i < MAX_SITES; i++) {
+        count += totals[i].count;
+        bytes += totals[i].bytes;
+    }
+    unsigned long peak = sum->peakLiveBytes;
 
-        return ptr;
+    AllocSite *sorted[MAX_SITES];
+    int used = 0;
+    for (int i = 0; i < MAX_SITES; i++) {
+        if (totals[i].count > 0) {
+            sorted[used] = &totals[i];
+            used++;
+        }
     }
+    qsort(sorted, used, sizeof(AllocSite *), siteCompare);
+
+    fprintf(stderr, "%12s %14s %14s  %-24s %s\n",
+            "allocs", "bytes", "peak live", "site", "kind");
+    for (int i = 0; i < used; i++) {
+        fprintf(stderr, "%12lu %14lu %14lu  %-24s %s\n",
+                sorted[i]->count, sorted[i]->bytes, sorted[i]->peak,
+                sorted[i]->name, kindNames[sorted[i]->kind]);
+    }
+    fprintf(stderr, "%12lu %14lu %14lu  %-24s\n",
+            count, bytes, peak, "(total)");
+    free(sum);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "peak RSS: %ld KB\n", usage.ru_maxrss);
+}
+
+// Returns a marker for the current end of the calling thread's heap
+void *tmark() {
+    if (heap.chunk == NULL) {
+        return NULL;
+    }
+    return heap.chunk->data + heap.chunk->used;
+}
+
+// Takes the blocks from offset on out of the statistics
+void uncountBlocks(Chunk *chunk, size_t offset) {
+    while (offset < chunk->used) {
+        BlockHeader *header = (BlockHeader *) (chunk->data + offset);
+        heap.sites[header->site].live -= header->size;
+        heap.liveBytes -= header->size;
+        offset += header->space;
+    }
+}
+
+void sharedHold(Shared *shared) {
+    __atomic_fetch_add(&shared->refs, 1, __ATOMIC_RELAXED);
+}
+
+void sharedDrop(Shared *shared) {
+    if (__atomic_sub_fetch(&shared->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        shared->free(shared);
+    }
+}
+
+void tshare(Shared *shared) {
+    sharedHold(shared);
+    SharedRef *ref = talloc(sizeof(SharedRef));
+    ref->shared = shared;
+    ref->next = heap.chunk->refs;
+    heap.chunk->refs = ref;
+}
+
+// Drops the references made in chunk from offset on
+void dropRefs(Chunk *chunk, size_t offset) {
+    while (chunk->refs != NULL &&
+           (char *) chunk->refs >= chunk->data + offset) {
+        SharedRef *ref = chunk->refs;
+        chunk->refs = ref->next;
+        sharedDrop(ref->shared);
+    }
+}
+
+// Frees everything talloc'd since mark was taken: the blocks after it in the
+// chunk it points into, and every chunk started since.
+void trelease(void *mark) {
+    char *mark_byte = mark;
+    while (heap.chunk != NULL) {
+        Chunk *chunk = heap.chunk;
+        if (mark_byte >= chunk->data && mark_byte <= chunk->data + chunk->size) {
+            size_t offset = mark_byte - chunk->data;
+            if (allocStats) {
+                uncountBlocks(chunk, offset);
+            }
+            dropRefs(chunk, offset);
+            chunk->used = offset;
+            return;
+        }
+        if (allocStats) {
+            uncountBlocks(chunk, 0);
+        }
+        dropRefs(chunk, 0);
+        heap.chunk = chunk->prev;
+        giveChunk(chunk);
+    }
+}
+
+// Registers the calling thread's heap so that tfree frees it
+void tallocThreadStart() {
+    pthread_mutex_lock(&tallocLock);
+    threadsStarted = 1;
+    pthread_mutex_unlock(&tallocLock);
+    registerHeap();
+}
+
+void tallocThreadEnd() {
+    trelease(NULL);
+    freeStackRegion();
+    while (heap.spares != NULL) {
+        Chunk *chunk = heap.spares;
+        heap.spares = chunk->prev;
+        shareChunk(chunk);
+    }
+    heap.spareCount = 0;
+    pthread_mutex_lock(&tallocLock);
+    addHeapStats(&finishedThreads, &heap);
+    for (int i = 0; i < threadHeapCount; i++) {
+        if (threadHeaps[i] == &heap) {
+            threadHeaps[i] = threadHeaps[--threadHeapCount];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&tallocLock);
+}
+
+// The stack region is a list of chunks, each used from the bottom up. Chunks
+// above the current one are empty and kept for reuse.
+#define STACK_CHUNK_SIZE (64 * 1024)
+
+typedef struct StackChunk {
+    struct StackChunk *prev;
+    struct StackChunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+} StackChunk;
+
+__thread StackChunk *stackChunk = NULL;
+
+// Returns size bytes from the stack region, 16-byte aligned
+void *salloc(size_t size) {
+    size = (size + 15) & ~(size_t) 15;
+    while (stackChunk == NULL || stackChunk->used + size > stackChunk->size) {
+        if (stackChunk != NULL && stackChunk->next != NULL &&
+            stackChunk->next->size >= size) {
+            stackChunk = stackChunk->next;
+            continue;
+        }
+        size_t chunk_size = size > STACK_CHUNK_SIZE ? size : STACK_CHUNK_SIZE;
+        StackChunk *chunk = malloc(sizeof(StackChunk) + chunk_size);
+        if (chunk == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            texit(1);
+        }
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->prev = stackChunk;
+        chunk->next = NULL;
+        if (stackChunk != NULL) {
+            // Spare chunks too small for this block are dropped
+            StackChunk *spare = stackChunk->next;
+            while (spare != NULL) {
+                StackChunk *next = spare->next;
+                free(spare);
+                spare = next;
+            }
+            stackChunk->next = chunk;
+        }
+        stackChunk = chunk;
+    }
+    void *block = stackChunk->data + stackChunk->used;
+    stackChunk->used += size;
+    return block;
+}
+
+// Returns a marker for the current top of the stack region
+void *smark() {
+    if (stackChunk == NULL) {
+        return NULL;
+    }
+    return stackChunk->data + stackChunk->used;
+}
+
+// Frees everything salloc'd since mark was taken, walking back to the chunk
+// the mark points into
+void srelease(void *mark) {
+    while (stackChunk != NULL) {
+        char *mark_byte = mark;
+        if (mark_byte >= stackChunk->data &&
+            mark_byte <= stackChunk->data + stackChunk->size) {
+            stackChunk->used = mark_byte - stackChunk->data;
+            return;
+        }
+        stackChunk->used = 0;
+        if (stackChunk->prev == NULL) {
+            return;
+        }
+        stackChunk = stackChunk->prev;
+    }
+}
+
+void *sswitch(void *region) {
+    void *previous = stackChunk;
+    stackChunk = region;
+    return previous;
+}
+
+void freeStackRegion() {
+    // Back to the first chunk, then free it and every spare chunk above it
+    srelease(NULL);
+    while (stackChunk != NULL) {
+        StackChunk *next = stackChunk->next;
+        free(stackChunk);
+        stackChunk = next;
+    }
+}
+
+void *tswitch(void *other) {
+    Chunk *previous = heap.chunk;
+    heap.chunk = other;
+    return previous;
 }
 
 // Free all pointers allocated by talloc, as well as whatever memory you
 // allocated in lists to hold those pointers.
 void tfree() {
-    Value *cur_node = pointers;
-    // Iterate through linked list...
-    while ((*cur_node).type != NULL_TYPE) {
-        struct ConsCell cons_cell = (*cur_node).c;
-        Value *car_val = cons_cell.car;
-        Value *cdr_val = cons_cell.cdr;
-
-        // First freeing pointer member vars, and car Value storing it
-        void *ptr = (*car_val).p;
-        free(ptr);
-        free(car_val);
-        // and then using a temp pointer to free Value containing ConsCell
-        Value *temp_ptr = cur_node;
-        cur_node = cdr_val;
-        free(temp_ptr);
-    }
-    // Free last NULL_TYPE Value in linked list
-    free(cur_node);
-    // Reset list of pointers to be null, as it is now empty
-    pointers = NULL;
-    // Frees pointer to back of list that would have been inaccessible
-    free(pointers_copy);
+    trelease(NULL);
+    // The other threads' chunks. Those threads must be idle.
+    pthread_mutex_lock(&tallocLock);
+    for (int i = 0; i < threadHeapCount; i++) {
+        ThreadHeap *thread = threadHeaps[i];
+        Chunk *lists[2] = {thread->chunk, thread->spares};
+        for (int j = 0; j < 2; j++) {
+            while (lists[j] != NULL) {
+                Chunk *prev = lists[j]->prev;
+                dropRefs(lists[j], 0);
+                free(lists[j]);
+                lists[j] = prev;
+            }
+        }
+        thread->chunk = NULL;
+        thread->spares = NULL;
+        thread->spareCount = 0;
+    }
+    pthread_mutex_unlock(&tallocLock);
+    while (heap.spares != NULL) {
+        Chunk *prev = heap.spares->prev;
+        free(heap.spares);
+        heap.spares = prev;
+    }
+    heap.spareCount = 0;
+    Chunk *shared = __atomic_exchange_n(&freeChunks, NULL, __ATOMIC_ACQUIRE);
+    while (shared != NULL) {
+        Chunk *prev = shared->prev;
+        free(shared);
+        shared = prev;
+    }
+    freeStackRegion();
 }
 
 // Replacement for the C function "exit", that consists of two lines: it calls
 // tfree before calling exit. It's useful to have later on; if an error happens,
 // you can exit your program, and all memory is automatically cleaned up.
+//
+// Once other threads have been started, they may still be using memory when
+// one of them exits, so the memory is left for the system to reclaim.
+__thread jmp_buf *exitTrap = NULL;
+
 void texit(int status) {
-    tfree();
+    if (exitTrap != NULL) {
+        longjmp(*exitTrap, status + 1);
+    }
+    if (!threadsStarted) {
+        tfree();
+    }
     exit(status);
-}
\ No newline at end of file
+}
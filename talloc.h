@@ -1,25 +1,118 @@
 #include <stdlib.h>
+#include <setjmp.h>
 #include "value.h"
 
 #ifndef _TALLOC
 #define _TALLOC
 
 
+// Kinds of object handed out by talloc, reported by --alloc-stats. The kind is
+// worked out from the size requested: a Value, a Frame, or anything else (token
+// text, other buffers). Cons cells are tagged separately by cons().
+typedef enum {ALLOC_VALUE, ALLOC_CONS, ALLOC_FRAME, ALLOC_BUFFER} allocKind;
+
+#define tallocKind(size) ((size) == sizeof(Value) ? ALLOC_VALUE : \
+                          (size) == sizeof(Frame) ? ALLOC_FRAME : ALLOC_BUFFER)
+
 // Replacement for malloc that stores the pointers allocated. It should store
 // the pointers in some kind of list; a linked list would do fine, but insert
 // here whatever code you'll need to do so; don't call functions in the
 // pre-existing linkedlist.h. Otherwise you'll end up with circular
 // dependencies, since you're going to modify the linked list to use talloc.
-void *talloc(size_t size);
+//
+// talloc is a macro so that every allocation is tagged with the name of the
+// function making it; tallocSite does the work. Each thread allocates from its
+// own buffer in a chunk taken from a pool shared by all threads, so threads
+// never wait for each other to allocate.
+#define talloc(size) tallocSite((size), tallocKind(size), __func__)
+void *tallocSite(size_t size, allocKind kind, const char *site);
+
+// Running totals of talloc calls and bytes requested by the calling thread
+// since it started. Cheap enough to keep unconditionally; the profiler reads
+// them.
+extern __thread unsigned long tallocCount;
+extern __thread unsigned long tallocBytes;
+
+// A thread other than the main one calls this when it starts, so that tfree
+// (called from the main thread, with the others idle) frees its blocks too,
+// and the statistics report includes them.
+void tallocThreadStart();
+
+// A thread that called tallocThreadStart calls this before it exits. It frees
+// the thread's heap and stack region, gives its spare chunks to the other
+// threads, and keeps its statistics for the report.
+void tallocThreadEnd();
+
+// Turns on per site allocation statistics: from now on every allocation is
+// counted against the function and kind it was tagged with, and a report of
+// counts, bytes and peak live bytes per site is printed to stderr at exit.
+void tallocStatsStart();
+
+// Prints the allocation statistics report.
+void tallocReport();
 
 // Free all pointers allocated by talloc, as well as whatever memory you
 // allocated in lists to hold those pointers.
 void tfree();
 
+// Returns a marker for the current end of the calling thread's heap. trelease
+// frees everything talloc'd since the marker was taken, leaving older blocks
+// alone, so a caller can throw away the results of a computation but keep its
+// input.
+void *tmark();
+void trelease(void *mark);
+
+// A block from malloc that several heaps may refer to, such as a record type
+// or mapped file that has been sent to actors. Each heap holding a reference
+// counts in refs, and free is called to free the block when the last
+// reference is dropped.
+typedef struct Shared {
+    long refs;
+    void (*free)(struct Shared *shared);
+} Shared;
+
+// Adds a reference to shared held by the calling thread's heap, dropped when
+// the heap is freed back past this point by trelease or tfree
+void tshare(Shared *shared);
+
+// Adds or drops a reference held by something other than a heap, such as a
+// message on its way to an actor
+void sharedHold(Shared *shared);
+void sharedDrop(Shared *shared);
+
+// A second, stack-like region for memory that is only needed until a call
+// returns, such as the frames of procedures that can't be captured by a
+// closure. salloc hands out blocks by bumping a pointer; srelease throws away
+// everything salloc'd since the matching smark, so marks must be released in
+// the reverse of the order they were taken. The region grows in chunks that
+// are kept for reuse until tfree.
+void *salloc(size_t size);
+void *smark();
+void srelease(void *mark);
+
+// Makes region the calling thread's stack region, and returns the region it
+// replaces, as tswitch does for heaps. region is NULL for a new, empty one.
+// Each green task has a region of its own, since tasks don't return in the
+// reverse of the order they were entered.
+void *sswitch(void *region);
+
+// Frees the calling thread's stack region
+void freeStackRegion();
+
+// Makes heap the calling thread's heap, and returns the heap it replaces.
+// heap is NULL for a new, empty heap, or a heap returned by an earlier call;
+// talloc, tmark and trelease then work on it until it is switched back. This
+// lets each embedded interpreter keep its own heap.
+void *tswitch(void *heap);
+
 // Replacement for the C function "exit", that consists of two lines: it calls
 // tfree before calling exit. It's useful to have later on; if an error happens,
 // you can exit your program, and all memory is automatically cleaned up.
+//
+// If the calling thread has set exitTrap, texit instead jumps there with
+// longjmp, passing status + 1, and frees nothing; this is how an embedding
+// program survives errors in the code it runs.
 void texit(int status);
+extern __thread jmp_buf *exitTrap;
 
 #endif
-
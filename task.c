@@ -0,0 +1,366 @@
+/* task.c - Green tasks switched between on one thread, and channels        */
+/* By Tore Banta & Charlie Sarano                                            */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+#include "value.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "profiler.h"
+#include "task.h"
+
+// Stack given to each task. Past STACK_RED_ZONE of it the evaluator moves on
+// to a stack segment, as it does on a thread's own stack, so deep recursion
+// in a task still works.
+#define TASK_STACK_SIZE (512 * 1024)
+
+// Stacks of finished tasks kept for new ones
+#define SPARE_STACKS 16
+
+// A task, or the thread's own stack, which rootTask stands for. A task starts
+// on context, made by makecontext. After that, when it isn't running, jump
+// holds where it left off, saved with __builtin_setjmp, which unlike
+// swapcontext doesn't save the signal mask and so needs no system call; eval,
+// profile and region hold its evaluator state, profiler state and stack
+// region. next links it into
+// the run queue or the queue of a channel it waits on, and prevLive and
+// nextLive into the list of the thread's tasks that haven't finished.
+typedef struct Task {
+    ucontext_t context;
+    void *jump[5];
+    int started;
+    char *stack;
+    Value *thunk;
+    EvalStack eval;
+    ProfileStack profile;
+    void *region;
+    // A value being passed through a channel to or from the task
+    Value *transfer;
+    struct Task *next;
+    struct Task *prevLive;
+    struct Task *nextLive;
+} Task;
+
+typedef struct TaskQueue {
+    Task *head;
+    Task *tail;
+} TaskQueue;
+
+// A channel has a ring buffer of up to capacity values, and queues of the
+// tasks waiting to put to it and get from it
+struct Channel {
+    Value **buffer;
+    int capacity;
+    int start;
+    int count;
+    TaskQueue putters;
+    TaskQueue getters;
+};
+
+__thread Task rootTask;
+__thread Task *currentTask = NULL;
+__thread TaskQueue runQueue = {NULL, NULL};
+
+// Every task made on the thread that hasn't finished, whether it is queued to
+// run, waiting on a channel or running
+__thread Task *liveTasks = NULL;
+
+// Set while the thread's own stack waits in runTasks for the queue to empty
+__thread int rootWaiting = 0;
+
+// A task that has finished, whose stack is freed by the next one to run
+__thread Task *finishedTask = NULL;
+
+__thread char *spareStacks[SPARE_STACKS];
+__thread int spareStackCount = 0;
+
+void enqueue(TaskQueue *queue, Task *task) {
+    task->next = NULL;
+    if (queue->tail == NULL) {
+        queue->head = task;
+    }
+    else {
+        queue->tail->next = task;
+    }
+    queue->tail = task;
+}
+
+Task *dequeue(TaskQueue *queue) {
+    Task *task = queue->head;
+    if (task != NULL) {
+        queue->head = task->next;
+        if (queue->head == NULL) {
+            queue->tail = NULL;
+        }
+    }
+    return task;
+}
+
+Task *thisTask() {
+    if (currentTask == NULL) {
+        rootTask.started = 1;
+        currentTask = &rootTask;
+    }
+    return currentTask;
+}
+
+// Takes a task off the list of live ones
+void unlinkTask(Task *task) {
+    if (task->prevLive != NULL) {
+        task->prevLive->nextLive = task->nextLive;
+    }
+    else {
+        liveTasks = task->nextLive;
+    }
+    if (task->nextLive != NULL) {
+        task->nextLive->prevLive = task->prevLive;
+    }
+}
+
+// Frees a task that isn't running, keeping its stack for a new task if there
+// is room
+void freeTask(Task *task) {
+    if (profiling) {
+        profileFreeStack(&task->profile);
+    }
+    if (spareStackCount < SPARE_STACKS) {
+        spareStacks[spareStackCount++] = task->stack;
+    }
+    else {
+        free(task->stack);
+    }
+    free(task);
+}
+
+// Frees the task that finished last, now that its stack isn't in use
+void freeFinished() {
+    Task *task = finishedTask;
+    if (task == NULL) {
+        return;
+    }
+    finishedTask = NULL;
+    freeTask(task);
+}
+
+// Carries on with a task, or starts it. __builtin_longjmp can't be called
+// from the function that called the matching __builtin_setjmp, so this is
+// kept separate from switchTo.
+__attribute__((noinline)) void resumeTask(Task *task) {
+    if (task->started) {
+        __builtin_longjmp(task->jump, 1);
+    }
+    task->started = 1;
+    setcontext(&task->context);
+}
+
+// Makes next the running task, setting up the thread's evaluator state and
+// stack region for it. The calling task's are saved first unless it has
+// finished, in which case it is never returned to.
+void switchTo(Task *next) {
+    Task *self = thisTask();
+    if (next == self) {
+        return;
+    }
+    currentTask = next;
+    if (profiling) {
+        profileSaveStack(&self->profile);
+        profileRestoreStack(&next->profile);
+    }
+    if (self == finishedTask) {
+        sswitch(next->region);
+        restoreEvalStack(&next->eval);
+        resumeTask(next);
+    }
+    saveEvalStack(&self->eval);
+    self->region = sswitch(next->region);
+    restoreEvalStack(&next->eval);
+    if (__builtin_setjmp(self->jump) == 0) {
+        resumeTask(next);
+    }
+    // Switched back to by another task
+    freeFinished();
+}
+
+// Returns the task to switch to when the running one can't go on: the first
+// in the run queue, or the thread's own stack if it is waiting for the queue
+// to empty
+Task *nextTask() {
+    Task *next = dequeue(&runQueue);
+    if (next != NULL) {
+        return next;
+    }
+    if (rootWaiting) {
+        return &rootTask;
+    }
+    evaluationError(17);
+    return NULL;
+}
+
+// Body of every task
+void taskMain() {
+    freeFinished();
+    Task *self = currentTask;
+    apply(self->thunk, 0, NULL);
+    // Nothing salloc'd by the task is still in use
+    freeStackRegion();
+    Task *next = nextTask();
+    unlinkTask(self);
+    finishedTask = self;
+    switchTo(next);
+}
+
+void spawnTask(Value *thunk) {
+    Task *task = malloc(sizeof(Task));
+    char *stack = NULL;
+    if (spareStackCount > 0) {
+        stack = spareStacks[--spareStackCount];
+    }
+    else {
+        stack = malloc(TASK_STACK_SIZE);
+    }
+    if (task == NULL || stack == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        texit(1);
+    }
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = stack;
+    task->context.uc_stack.ss_size = TASK_STACK_SIZE;
+    task->context.uc_link = NULL;
+    makecontext(&task->context, taskMain, 0);
+    task->started = 0;
+    task->stack = stack;
+    task->thunk = thunk;
+    newEvalStack(&task->eval, stack, TASK_STACK_SIZE);
+    if (profiling) {
+        profileNewStack(&task->profile);
+    }
+    task->region = NULL;
+    task->transfer = NULL;
+    task->prevLive = NULL;
+    task->nextLive = liveTasks;
+    if (liveTasks != NULL) {
+        liveTasks->prevLive = task;
+    }
+    liveTasks = task;
+    enqueue(&runQueue, task);
+}
+
+void yieldTask() {
+    if (runQueue.head == NULL) {
+        return;
+    }
+    Task *self = thisTask();
+    Task *next = dequeue(&runQueue);
+    enqueue(&runQueue, self);
+    switchTo(next);
+}
+
+// Makes the running task wait in queue until another wakes it
+void waitIn(TaskQueue *queue) {
+    Task *next = nextTask();
+    enqueue(queue, thisTask());
+    switchTo(next);
+}
+
+struct Channel *makeChannel(int capacity) {
+    struct Channel *channel = talloc(sizeof(struct Channel));
+    channel->buffer = capacity > 0 ? talloc(capacity * sizeof(Value *)) : NULL;
+    channel->capacity = capacity;
+    channel->start = 0;
+    channel->count = 0;
+    channel->putters.head = channel->putters.tail = NULL;
+    channel->getters.head = channel->getters.tail = NULL;
+    return channel;
+}
+
+void channelPut(struct Channel *channel, Value *value) {
+    Task *getter = dequeue(&channel->getters);
+    if (getter != NULL) {
+        // Straight to a task waiting for it
+        getter->transfer = value;
+        enqueue(&runQueue, getter);
+    }
+    else if (channel->count < channel->capacity) {
+        int end = (channel->start + channel->count) % channel->capacity;
+        channel->buffer[end] = value;
+        channel->count++;
+    }
+    else {
+        Task *self = thisTask();
+        self->transfer = value;
+        waitIn(&channel->putters);
+    }
+}
+
+Value *channelGet(struct Channel *channel) {
+    Value *value;
+    if (channel->count > 0) {
+        value = channel->buffer[channel->start];
+        channel->start = (channel->start + 1) % channel->capacity;
+        channel->count--;
+        // Room for the first waiting putter's value
+        Task *putter = dequeue(&channel->putters);
+        if (putter != NULL) {
+            int end = (channel->start + channel->count) % channel->capacity;
+            channel->buffer[end] = putter->transfer;
+            channel->count++;
+            enqueue(&runQueue, putter);
+        }
+        return value;
+    }
+    Task *putter = dequeue(&channel->putters);
+    if (putter != NULL) {
+        enqueue(&runQueue, putter);
+        return putter->transfer;
+    }
+    Task *self = thisTask();
+    waitIn(&channel->getters);
+    return self->transfer;
+}
+
+void runTasks() {
+    while (runQueue.head != NULL) {
+        Task *next = dequeue(&runQueue);
+        rootWaiting = 1;
+        switchTo(next);
+        rootWaiting = 0;
+    }
+}
+
+void resetTasks() {
+    if (currentTask != NULL && currentTask != &rootTask) {
+        // What the abandoned task salloc'd goes with it; its stack segments
+        // are the evaluator's current ones, which resetEvaluator frees
+        freeStackRegion();
+        sswitch(rootTask.region);
+        currentTask->region = NULL;
+        currentTask->eval.segment = NULL;
+        if (profiling) {
+            profileSaveStack(&currentTask->profile);
+            profileRestoreStack(&rootTask.profile);
+        }
+    }
+    // Every other task is dropped too, queued or waiting, along with its
+    // stack, stack region and stack segments
+    freeFinished();
+    while (liveTasks != NULL) {
+        Task *task = liveTasks;
+        unlinkTask(task);
+        if (task->region != NULL) {
+            void *previous = sswitch(task->region);
+            freeStackRegion();
+            sswitch(previous);
+        }
+        freeEvalStack(&task->eval);
+        freeTask(task);
+    }
+    // The thread's own stack is running again, so switching back to it later
+    // must jump rather than start it afresh
+    rootTask.started = 1;
+    currentTask = &rootTask;
+    runQueue.head = runQueue.tail = NULL;
+    rootWaiting = 0;
+}
@@ -0,0 +1,43 @@
+#include "value.h"
+
+#ifndef _TASK
+#define _TASK
+
+// Green tasks: (spawn-task thunk) makes a task that calls thunk with no
+// arguments, on a small C stack of its own, and adds it to the end of the
+// calling thread's run queue. Tasks take turns on the thread that made them:
+// one runs until it calls (yield), which sends it to the back of the queue,
+// or waits on a channel, and the task at the front of the queue runs next.
+// Switching is a swap of register contexts, with no system scheduler
+// involved. The program itself is a task too; whatever tasks can still run
+// when it ends are run then.
+//
+// (make-channel n) makes a channel holding up to n values, or none for
+// (make-channel): (channel-put! c v) then waits for a task to take v with
+// (channel-get c). channel-put! waits while the channel is full, and
+// channel-get while it is empty. Waiting tasks are woken in the order they
+// started waiting. It is an error for the program to wait when no task can
+// run.
+//
+// Tasks and channels belong to the thread that made them, and must not be
+// shared with futures or sent to actors.
+
+// Makes a task calling thunk, to run when the calling task next yields or
+// waits
+void spawnTask(Value *thunk);
+
+// Lets every other task that can run have a turn before carrying on
+void yieldTask();
+
+struct Channel *makeChannel(int capacity);
+void channelPut(struct Channel *channel, Value *value);
+Value *channelGet(struct Channel *channel);
+
+// Runs tasks until none can run
+void runTasks();
+
+// Forgets the calling thread's run queue and returns to its own stack's
+// state, after an error has abandoned the task it happened in
+void resetTasks();
+
+#endif
@@ -7,6 +7,7 @@
 #include "talloc.h"
 #include "linkedlist.h"
 #include "value.h"
+#include "interpreter.h"
 
 //Helper functions to determine valid syntax and token type for tokenize()
 
@@ -194,12 +195,12 @@ int is_space(char input) {
     return 0;
 }
 
-// Read all of the input from stdin, and return a linked list consisting of the
-// tokens.
-Value *tokenize() {
+// Read all of the input from a file, and return a linked list consisting of
+// the tokens.
+Value *tokenize(FILE *input) {
     char charRead;
     Value *list = makeNull();
-    charRead = fgetc(stdin);
+    charRead = fgetc(input);
 
     while (charRead != EOF) {
         // Two if statements to catch open and close parens
@@ -229,7 +230,7 @@ Value *tokenize() {
         // Removes characters until the new line character
         else if (charRead == ';') {
             while (charRead != '\n' && charRead != EOF) {
-                charRead = fgetc(stdin);
+                charRead = fgetc(input);
             }
             ;
         }
@@ -239,18 +240,18 @@ Value *tokenize() {
             test_string[0] = '\0';
             int length = 0; //used to keep track of length of array
             int memSize = 199;
-            charRead = fgetc(stdin);
+            charRead = fgetc(input);
             
             while (charRead != '"') {
                 // If end of file is reached before double quote, throw error
                 if (charRead == EOF) {
-                    printf("String untokenizable, missing quote\n");
+                    fprintf(outputFile, "String untokenizable, missing quote\n");
                     texit(1);
                 }
                 // If an escape character is encountered in string,
                 // function says charRead is intended character
                 else if (charRead == '\\'){
-                    char nextChar = fgetc(stdin);
+                    char nextChar = fgetc(input);
                     if (nextChar == 'n') {
                         charRead = '\n';
                     }
@@ -292,12 +293,13 @@ Value *tokenize() {
                     test_string[length] = '\0';
                     
                 }
-                charRead = fgetc(stdin);
+                charRead = fgetc(input);
             }
             // Adds the string to the list of Values
             Value *string_to_add = talloc(sizeof(Value));
             (*string_to_add).type = STR_TYPE;
-            (*string_to_add).s = test_string;
+            (*string_to_add).str.chars = test_string;
+            (*string_to_add).str.length = length;
             list = cons(string_to_add, list);
         }
         // Else statement that covers numbers, bools, and symbols
@@ -308,7 +310,7 @@ Value *tokenize() {
             int memSize2 = 199;
             while ((!is_brace(charRead)) && (!is_space(charRead))) {
                 if (charRead == EOF) {
-                    printf("Syntax Error: Incomplete Token\n");
+                    fprintf(outputFile, "Syntax Error: Incomplete Token\n");
                     texit(1);
                 }
                 else if (charRead == '\n' || charRead == '\t') {
@@ -330,10 +332,10 @@ Value *tokenize() {
                     // Null terminator used for helper functions
                     token[length2] = '\0';
                 }
-                charRead = fgetc(stdin);
+                charRead = fgetc(input);
             }
             // Ungetting a character that was a brace or a space
-            ungetc(charRead, stdin);
+            ungetc(charRead, input);
 
             if (is_number(token)) {
                 // Determine if integer or float, store in value...
@@ -359,7 +361,7 @@ Value *tokenize() {
                     }
                     // If the number isn't an int or decimal, throw error
                     else {
-                        printf("Syntax Error: '%s' untokenizable \n", token);
+                        fprintf(outputFile, "Syntax Error: '%s' untokenizable \n", token);
                     }
                 }
                 // If statements where the first character isn't a sign
@@ -377,12 +379,12 @@ Value *tokenize() {
                         list = cons(double_val, list);
                     }
                     else {
-                        printf("Syntax Error: '%s' untokenizable \n", token);
+                        fprintf(outputFile, "Syntax Error: '%s' untokenizable \n", token);
                     }
                 }
                 // If the first character somehow doesn't fit into first two ifs
                 else {
-                    printf("Syntax Error: '%s' untokenizable \n", token);
+                    fprintf(outputFile, "Syntax Error: '%s' untokenizable \n", token);
                     texit(1);
                 }
                     
@@ -392,6 +394,8 @@ Value *tokenize() {
                 Value *symbol = talloc(sizeof(Value));
                 (*symbol).type = SYMBOL_TYPE;
                 (*symbol).s = token;
+                (*symbol).sym.cell = NULL;
+                (*symbol).sym.version = SYMBOL_UNCACHED;
                 list = cons(symbol, list);
             }
             // If the token is a bool
@@ -411,11 +415,11 @@ Value *tokenize() {
             }
             // Error thrown because the token doesn't fit into syntax category
             else {
-                printf("Syntax Error: '%s' untokenizable \n", token);
+                fprintf(outputFile, "Syntax Error: '%s' untokenizable \n", token);
                 texit(1);
             }
         }
-        charRead = fgetc(stdin);
+        charRead = fgetc(input);
     }
     // Reverses list to present tokens in order
     Value *revList = reverse(list);
@@ -448,7 +452,8 @@ void displayTokens(Value *list) {
                 printf("%f:float\n", (*car_val).d);
                 break;
             case STR_TYPE:
-                printf("\"%s\":string\n", (*car_val).s);
+                printf("\"%.*s\":string\n", (int) (*car_val).str.length,
+                       (*car_val).str.chars);
                 break;
             case SYMBOL_TYPE:
                 printf("%s:symbol\n", (*car_val).s);
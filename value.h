@@ -1,11 +1,43 @@
+#include <stddef.h>
+
 #ifndef _VALUE
 #define _VALUE
 
 typedef enum {INT_TYPE,DOUBLE_TYPE,STR_TYPE,CONS_TYPE,NULL_TYPE,PTR_TYPE,
               OPEN_TYPE,CLOSE_TYPE,BOOL_TYPE,SYMBOL_TYPE,VOID_TYPE,CLOSURE_TYPE,
-              PRIMITIVE_TYPE} 
+              PRIMITIVE_TYPE,MEMOIZED_TYPE,HASH_TYPE,
+              PMAP_TYPE,FUTURE_TYPE,ACTOR_TYPE,CHANNEL_TYPE,RECORD_TYPE,
+              RECORD_PROC_TYPE,BYTEVECTOR_TYPE} 
     valueType;
 
+// Value of sym.version for symbols whose references must never be cached,
+// either because they may refer to a local variable or because they haven't
+// been looked at by resolveGlobals() yet
+#define SYMBOL_UNCACHED ((unsigned long) -1)
+
+// What the evaluator knows about one lambda expression in the parse tree,
+// worked out once by resolveGlobals() and shared by every closure made from
+// it. A lambda whose body contains no lambda expression can never have its
+// frame captured, so localFrame is set and each call's frame is allocated on
+// the stack region and thrown away when the call returns. freeNames lists the
+// local variables of enclosing scopes the body refers to; when flat is set,
+// closures capture just the bindings of those instead of the whole frame.
+struct Lambda {
+    struct Value *paramNames;
+    struct Value *functionCode;
+    int localFrame;
+    int flat;
+    struct Value *freeNames;
+};
+
+// A memoized procedure: function, and a table of the results it has returned
+// keyed by the list of arguments they were returned for
+struct Memo {
+    struct Value *function;
+    struct HashTable *table;
+    unsigned long hits;
+    unsigned long misses;
+};
 
 struct Value {
     valueType type;
@@ -13,6 +45,27 @@ struct Value {
         int i;
         double d;
         char *s;
+        // A string of length characters starting at chars. Strings are never
+        // changed, so a substring shares the characters of the string it was
+        // taken from, and chars isn't necessarily followed by a NUL.
+        struct String {
+            char *chars;
+            size_t length;
+        } str;
+        // Symbols in the parse tree also carry an inline cache for the
+        // evaluator: the global binding the reference last resolved to, valid
+        // while version matches the interpreter's global version counter.
+        // name is the same pointer as s. The lambda symbol at the head of a
+        // lambda expression isn't a reference, and keeps the expression's
+        // Lambda description in the same slot instead.
+        struct Symbol {
+            char *name;
+            union {
+                struct Value *cell;
+                struct Lambda *lambda;
+            };
+            unsigned long version;
+        } sym;
         void *p;
         struct ConsCell {
             struct Value *car;
@@ -20,18 +73,46 @@ struct Value {
         } c;
         // For purposes of this project a closure is just another type of value,
         // containing everything needed to execute a user-defined function: (1)
-        // a list of formal parameter names; (2) a pointer to the function body;
-        // (3) a pointer to the environment frame in which the function was
-        // created.
+        // the lambda it was made from, with the list of formal parameter names
+        // and a pointer to the function body; (2) a pointer to the environment
+        // frame in which the function was created.
         struct Closure {
-            struct Value *paramNames;
-            struct Value *functionCode;
+            struct Lambda *lambda;
             struct Frame *frame;
         } cl;
         
-        // A primitive style function; just a pointer to it, with the right
-        // signature (pf = primitive function)
-        struct Value *(*pf)(struct Value *);
+        // A primitive style function; a pointer to its entry in the table of
+        // primitives, which has the function itself and its arity
+        struct Primitive *prim;
+        
+        struct Memo *memo;
+        
+        // A mutable hash table made by make-hash-table
+        struct HashTable *table;
+        
+        // An immutable map made by pmap and pmap-assoc
+        struct Pmap *pmap;
+        
+        // A computation started by future
+        struct Future *future;
+        
+        // An actor started by spawn, or the mailbox of a thread that called
+        // self or receive
+        struct Actor *actor;
+        
+        // A channel between green tasks made by make-channel
+        struct Channel *channel;
+        
+        // A record made by a constructor from define-record-type, whose
+        // type and slots are in the same allocation as the Value
+        struct Record *record;
+        
+        // A constructor, predicate, accessor or modifier defined by
+        // define-record-type
+        struct RecordProcedure *recordProc;
+        
+        // An array of bytes made by make-bytevector or file->bytevector
+        struct Bytevector *bytevector;
     };
 };
 